@@ -1,5 +1,6 @@
 import sys
 from setuptools import setup, Extension
+from setuptools.command.build_ext import build_ext as _build_ext
 import numpy as np
 import os, os.path, struct, re, platform
 
@@ -8,34 +9,50 @@ long_description = ''
 for line in open(os.path.join(here, 'README.rst'), encoding='utf-8'):
     long_description += re.sub(r'^<.+>\s*$', '', line)
 
-sources = ['src/PyMain.cpp', 'src/Lemmatizer.cpp']
+sources = ['src/PyMain.cpp', 'src/Lemmatizer.cpp', 'src/kernels.cpp']
 largs = ['-pthread']
-arch_levels = {'':'', 'sse2':'-msse2', 'avx':'-mavx', 'avx2':'-mavx2 -mfma'}
+arch_native = []
+# kernels compiled once per instruction set, the best one is selected at runtime (see src/kernels.cpp).
+# The hot loops of tagging all live there, so wheels built without `-march=native` lose little.
+isa_sources = {'src/kernels_none.cpp':'', 'src/kernels_avx2.cpp':'-mavx2 -mfma -mf16c', 'src/kernels_avx512.cpp':'-mavx512f -mavx512bw -mavx2 -mfma -mf16c'}
 if platform.system() == 'Windows': 
     cargs = ['/O2', '/MT', '/Gy']
-    arch_levels = {'':'', 'sse2':'/arch:SSE2', 'avx':'/arch:AVX', 'avx2':'/arch:AVX2'}
+    isa_sources = {'src/kernels_none.cpp':'', 'src/kernels_avx2.cpp':'/arch:AVX2', 'src/kernels_avx512.cpp':'/arch:AVX512'}
+    if struct.calcsize('P') < 8: isa_sources['src/kernels_none.cpp'] = '/arch:SSE2'
 elif platform.system() == 'Darwin': 
     cargs = ['-std=c++0x', '-O3', '-fpermissive', '-stdlib=libc++', '-Wno-unused-variable', '-Wno-switch']
     largs += ['-stdlib=libc++']
-    if 'many' not in os.environ.get('AUDITWHEEL_PLAT', ''): arch_levels = {'':'-march=native'}
+    if 'many' not in os.environ.get('AUDITWHEEL_PLAT', ''): arch_native = ['-march=native']
 elif 'many' in os.environ.get('AUDITWHEEL_PLAT', ''):
     cargs = ['-std=c++0x', '-O3', '-fpermissive', '-g0', '-Wno-unused-variable', '-Wno-switch']
 else:
     cargs = ['-std=c++0x', '-O3', '-fpermissive', '-Wno-unused-variable', '-Wno-switch']
-    arch_levels = {'':'-march=native'}
+    arch_native = ['-march=native']
 
-if struct.calcsize('P') < 8: arch_levels = {k:v for k, v in arch_levels.items() if k in ('', 'sse2')}
-else: arch_levels = {k:v for k, v in arch_levels.items() if k not in ('sse2',)}
+if platform.system() != 'Windows' and struct.calcsize('P') < 8: isa_sources['src/kernels_none.cpp'] = '-msse2'
+if not re.match(r'(x86|i[3-6]86|amd64)', platform.machine().lower()): isa_sources = {k:'' for k in isa_sources}
 
-modules = []
-for arch, aopt in arch_levels.items():
-    module_name = '_lamonpy' + ('_' + arch if arch else '')
-    modules.append(Extension(module_name,
-                    libraries=[],
-                    include_dirs=['include', np.get_include()],
-                    sources=sources,
-                    define_macros=[('MODULE_NAME', 'PyInit_' + module_name)],
-                    extra_compile_args=cargs + (aopt.split(' ') if aopt else []), extra_link_args=largs))
+class build_ext(_build_ext):
+    '''compiles each of `isa_sources` with its own instruction set flags and links them into the extension'''
+    def build_extension(self, ext):
+        objects = []
+        for src, aopt in isa_sources.items():
+            objects += self.compiler.compile([src],
+                output_dir=self.build_temp,
+                macros=ext.define_macros,
+                include_dirs=ext.include_dirs,
+                extra_postargs=cargs + (aopt.split(' ') if aopt else []),
+                depends=['src/kernels.hpp', 'src/kernels_impl.hpp'])
+        ext.extra_objects = objects
+        super().build_extension(ext)
+
+modules = [Extension('_lamonpy',
+                libraries=[],
+                include_dirs=['include', np.get_include()],
+                sources=sources,
+                define_macros=[('MODULE_NAME', 'PyInit__lamonpy')],
+                depends=['src/kernels.hpp'],
+                extra_compile_args=cargs + arch_native, extra_link_args=largs)]
 
 setup(
     name='lamonpy',
@@ -71,10 +88,11 @@ setup(
         "Operating System :: POSIX",
         "Operating System :: MacOS"
     ],
-    install_requires=['py-cpuinfo', 'numpy>=1.10.0'],
+    install_requires=['numpy>=1.10.0'],
     keywords='NLP,Latin',
 
     packages = ['lamonpy'],
     include_package_data=True,
-    ext_modules=modules
+    ext_modules=modules,
+    cmdclass={'build_ext': build_ext}
 )
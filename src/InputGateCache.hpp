@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "LatinFeat.h"
+
+namespace lamon
+{
+    /*
+    * A bounded, thread-safe map from a decoded output (token, feature) to
+    * the input half of the LSTM gates it produces at the next step, i.e. `W_x^T * layernorm(embedding) + bias`.
+    * Entries are never evicted: once `capacity` entries are stored, new outputs are simply not cached.
+    * Because entries are immutable after insertion, `find` can hand out pointers into the storage.
+    */
+    class InputGateCache
+    {
+        static constexpr size_t num_shards = 64;
+
+        struct Key
+        {
+            uint64_t token, feature;
+
+            bool operator==(const Key& o) const
+            {
+                return token == o.token && feature == o.feature;
+            }
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& k) const
+            {
+                return (size_t)((k.token * 0x9E3779B97F4A7C15ull) ^ (k.feature * 0xC2B2AE3D27D4EB4Full));
+            }
+        };
+
+        struct Shard
+        {
+            std::mutex mtx;
+            std::unordered_map<Key, const float*, KeyHash> map;
+            std::unique_ptr<float[]> storage;
+            size_t used = 0;
+        };
+
+        size_t dim = 0, shard_capacity = 0;
+        std::unique_ptr<Shard[]> shards;
+
+        Shard& get_shard(const Key& key) const
+        {
+            return shards[(KeyHash{}(key) * 0x9E3779B97F4A7C15ull) >> 58];
+        }
+
+    public:
+        InputGateCache(size_t capacity, size_t _dim)
+            : dim{ _dim }, shard_capacity{ (capacity + num_shards - 1) / num_shards },
+            shards{ new Shard[num_shards] }
+        {
+        }
+
+        const float* find(size_t token, Feature feature) const
+        {
+            const Key key{ token, feature.u64 };
+            Shard& shard = get_shard(key);
+            std::lock_guard<std::mutex> lock{ shard.mtx };
+            auto it = shard.map.find(key);
+            return it == shard.map.end() ? nullptr : it->second;
+        }
+
+        void insert(size_t token, Feature feature, const float* gates)
+        {
+            const Key key{ token, feature.u64 };
+            Shard& shard = get_shard(key);
+            std::lock_guard<std::mutex> lock{ shard.mtx };
+            if (shard.used >= shard_capacity || shard.map.count(key)) return;
+            // allocated on the first insertion, so an unused cache costs nothing
+            if (!shard.storage) shard.storage.reset(new float[shard_capacity * dim]);
+            float* dest = &shard.storage[shard.used++ * dim];
+            std::memcpy(dest, gates, sizeof(float) * dim);
+            shard.map.emplace(key, dest);
+        }
+
+        size_t size() const
+        {
+            size_t ret = 0;
+            for (size_t i = 0; i < num_shards; ++i)
+            {
+                std::lock_guard<std::mutex> lock{ shards[i].mtx };
+                ret += shards[i].used;
+            }
+            return ret;
+        }
+    };
+}
@@ -1,5 +1,7 @@
 #include <sstream>
 #include <algorithm>
+#include <numeric>
+#include <unordered_set>
 #include "Lemmatizer.h"
 #include "serializer.hpp"
 
@@ -374,6 +376,9 @@ auto Lemmatizer::lemmatize(const char* str, size_t len) const -> vector<TokenInf
 			if (bpos >= len) break;
 			for (epos = bpos; epos < len; )
 			{
+				// ASCII letters and digits are neither spaces nor punctuations, so whole runs of them are skipped at once
+				epos += kernels::ascii_alnum_prefix(&str[epos], len - epos);
+				if (epos >= len) break;
 				auto p = read_uchar(&str[epos]);
 				if (is_whitespace(p.first)) break;
 				epos += p.second;
@@ -384,6 +389,8 @@ auto Lemmatizer::lemmatize(const char* str, size_t len) const -> vector<TokenInf
 			punc_length = 0;
 			for (size_t ppos = bpos; ppos < epos; )
 			{
+				ppos += kernels::ascii_alnum_prefix(&str[ppos], epos - ppos);
+				if (ppos >= epos) break;
 				auto p = read_uchar(&str[ppos]);
 				punc_length = is_punc(p.first) ? p.second : 0;
 				if (punc_length)
@@ -456,56 +463,218 @@ auto Lemmatizer::lemmatize(const string& str) const -> vector<TokenInfo>
 	return lemmatize(str.data(), str.size());
 }
 
-auto Lemmatizer::tag(const LatinRnnModel& tagging_model, 
-	const string& str, size_t beam_size, 
-	bool bidirection) const -> vector<Candidate>
+// sentence-final punctuations: . ! ? …
+inline bool is_sentence_final(int c)
 {
-	auto tokens = lemmatize(str);
-	auto results = tagging_model.decode(tokens.size(), beam_size, [&](size_t t, const RnnCell::Output& r)
+	return c == '.' || c == '!' || c == '?' || c == 0x2026;
+}
+
+// quotes and brackets which close a sentence along with its final punctuation: " ' ) ] } » ’ ” ›
+inline bool is_closing_mark(int c)
+{
+	return c == '"' || c == '\'' || c == ')' || c == ']' || c == '}' 
+		|| c == 0xBB || c == 0x2019 || c == 0x201D || c == 0x203A;
+}
+
+// tests whether `[first, last)`, a run of letters followed by a period, is an abbreviation
+static bool is_abbreviation(const char* str, size_t first, size_t last)
+{
+	static const unordered_set<string> praenomina = {
+		"Ap", "Cn", "Mam", "Oct", "Ser", "Sex", "Sp", "Ti", "Tib",
+	};
+	static const unordered_set<string> abbreviations = {
+		"ca", "cap", "cf", "cit", "cos", "coss", "ed", "edd", "ep", "epist", "etc", "fr", "ibid", "imp", "kal", "kalend", 
+		"leg", "lib", "nr", "pag", "pl", "pp", "pr", "praef", "procos", "sc", "scil", "sen", "sqq", "tr", "trib", "vid", "vol",
+	};
+
+	// inner parts of dotted ones such as `a.u.c.` or `i.e.`
+	if (first && str[first - 1] == '.') return true;
+	// initials and one-letter praenomina such as `C.` or `M.`
+	if (last - first == 1 && 'A' <= str[first] && str[first] <= 'Z') return true;
+
+	string word{ str + first, str + last };
+	if (praenomina.count(word)) return true;
+	transform(word.begin(), word.end(), word.begin(), [](char c) { return (char)tolower(c); });
+	return abbreviations.count(word) > 0;
+}
+
+auto Lemmatizer::split_sentences(const char* str, size_t len) -> vector<pair<uint32_t, uint32_t>>
+{
+	vector<pair<uint32_t, uint32_t>> ret;
+	// the start of the current sentence, `len` if none has begun yet
+	size_t begin = len;
+	// the end of the last non-space character
+	size_t last_end = 0;
+	// the last run of ASCII letters and digits
+	size_t word_begin = 0, word_end = 0;
+	size_t newlines = 0;
+
+	for (size_t pos = 0; pos < len; )
 	{
-		vector<LatinRnnModel::Candidate> ret;
-		
-		// unknown token
-		if (tokens[t].lemma_cands.empty())
+		auto p = read_uchar(&str[pos]);
+		if (is_whitespace(p.first))
 		{
-			RnnCell::DecOutput dec;
-			dec.first = tagging_model.get_unk_token();
-			if (all_of(&str[tokens[t].start], &str[tokens[t].end], isalpha))
+			// a blank line always ends a sentence
+			if (p.first == '\n' && ++newlines == 2 && begin < len)
 			{
-				for (size_t i = 0; i < 36; ++i)
-				{
-					dec.second.gender = i / 12 + 1;
-					dec.second.number = (i / 6) % 2 + 1;
-					dec.second.case_ = i % 6 + 1;
+				ret.emplace_back(begin, last_end);
+				begin = len;
+			}
+			pos += p.second;
+			continue;
+		}
 
-					ret.emplace_back(r[dec], dec);
-				}
+		newlines = 0;
+		if (begin == len) begin = pos;
+		if (size_t n = kernels::ascii_alnum_prefix(&str[pos], len - pos))
+		{
+			word_begin = pos;
+			word_end = pos += n;
+			last_end = pos;
+			continue;
+		}
+		if (!is_sentence_final(p.first))
+		{
+			last_end = pos += p.second;
+			continue;
+		}
+
+		// a run of final punctuations and closing marks ends the sentence together
+		size_t end = pos, finals = 0;
+		bool single_period = true;
+		while (end < len)
+		{
+			auto q = read_uchar(&str[end]);
+			if (is_sentence_final(q.first))
+			{
+				if (q.first != '.' || finals++) single_period = false;
+			}
+			else if (!is_closing_mark(q.first)) break;
+			end += q.second;
+		}
+
+		bool boundary = end >= len || is_whitespace(read_uchar(&str[end]).first);
+		if (boundary && single_period && word_end == pos && word_begin < word_end)
+		{
+			if (is_abbreviation(str, word_begin, word_end))
+			{
+				boundary = false;
 			}
 			else
 			{
-				ret.emplace_back(r[dec], dec);
+				string word;
+				transform(str + word_begin, str + word_end, back_inserter(word), Latinizer::tx_integrate);
+				if (is_numeral(word))
+				{
+					// `XII.` may be an ordinal or a heading, so it ends a sentence only before a capital
+					size_t next = end;
+					while (next < len)
+					{
+						auto q = read_uchar(&str[next]);
+						if (!is_whitespace(q.first)) break;
+						next += q.second;
+					}
+					boundary = next < len && 'A' <= str[next] && str[next] <= 'Z';
+				}
 			}
 		}
-		// known token
-		else
+
+		last_end = pos = end;
+		if (boundary)
 		{
-			for (auto& c : tokens[t].lemma_cands)
+			ret.emplace_back(begin, end);
+			begin = len;
+		}
+	}
+	if (begin < len) ret.emplace_back(begin, last_end);
+	return ret;
+}
+
+auto Lemmatizer::split_sentences(const string& str) -> vector<pair<uint32_t, uint32_t>>
+{
+	return split_sentences(str.data(), str.size());
+}
+
+// appends the candidates of `token` scored from `r` to `ret`, keeping at most the best `beam_size` of them
+static void select_candidates(const LatinRnnModel& tagging_model, const string& str, const Lemmatizer::TokenInfo& token, size_t beam_size,
+	const RnnCell::Output& r, vector<size_t>& cand_tokens, vector<LatinRnnModel::Candidate>& ret)
+{
+	// unknown token
+	if (token.lemma_cands.empty())
+	{
+		RnnCell::DecOutput dec;
+		dec.first = tagging_model.get_unk_token();
+		if (all_of(&str[token.start], &str[token.end], ::isalpha))
+		{
+			// every gender x number x case is scored at once, and only the best `beam_size` of them become candidates
+			float scores[36];
+			uint8_t order[36];
+			r.score_declensions(dec.first, scores);
+			iota(order, order + 36, 0);
+			const size_t k = min(beam_size, (size_t)36);
+			nth_element(order, order + k - 1, order + 36, [&](uint8_t a, uint8_t b)
 			{
-				RnnCell::DecOutput dec;
-				dec.first = c.lemma_id;
-				dec.second = c.feature;
-				ret.emplace_back(r[dec], dec);
+				return scores[a] > scores[b];
+			});
+			for (size_t j = 0; j < k; ++j)
+			{
+				const size_t i = order[j];
+				dec.second.gender = i / 12 + 1;
+				dec.second.number = (i / 6) % 2 + 1;
+				dec.second.case_ = i % 6 + 1;
+
+				ret.emplace_back(scores[i], dec);
 			}
 		}
-		sort(ret.rbegin(), ret.rend());
-		if (ret.size() > beam_size) ret.erase(ret.begin() + beam_size, ret.end());
-		return ret;
-	}, bidirection);
+		else
+		{
+			ret.emplace_back(r[dec], dec);
+		}
+	}
+	// known token
+	else
+	{
+		cand_tokens.clear();
+		for (auto& c : token.lemma_cands) cand_tokens.emplace_back(c.lemma_id);
+		r.prepare(cand_tokens.begin(), cand_tokens.end());
+
+		for (auto& c : token.lemma_cands)
+		{
+			RnnCell::DecOutput dec;
+			dec.first = c.lemma_id;
+			dec.second = c.feature;
+			ret.emplace_back(r[dec], dec);
+		}
+	}
+	// `decode` keeps at most `beam_size` paths, so only that many best candidates are needed, in any order
+	if (ret.size() > beam_size)
+	{
+		nth_element(ret.begin(), ret.begin() + beam_size, ret.end(), [](const LatinRnnModel::Candidate& a, const LatinRnnModel::Candidate& b)
+		{
+			return a.first > b.first;
+		});
+		ret.erase(ret.begin() + beam_size, ret.end());
+	}
+}
+
+// converts decoded sequences and their marginals over `tokens` into those of `Lemmatizer`
+static vector<Lemmatizer::Candidate> to_candidates(const vector<LatinRnnModel::DecSequence>& results, const vector<Lemmatizer::TokenInfo>& tokens,
+	const LatinRnnModel::Marginals& step_marginals, Lemmatizer::Marginals* marginals)
+{
+	if (marginals)
+	{
+		marginals->clear();
+		for (auto& m : step_marginals)
+		{
+			marginals->emplace_back();
+			for (auto& c : m) marginals->back().emplace_back(c.first, Lemmatizer::LemmaInfo{ (uint32_t)c.second.first, c.second.second });
+		}
+	}
 
-	vector<Candidate> ret;
+	vector<Lemmatizer::Candidate> ret;
 	for (auto& r : results)
 	{
-		vector<Token> toks;
+		vector<Lemmatizer::Token> toks;
 		for (size_t i = 0; i < r.second.size(); ++i)
 		{
 			toks.emplace_back(tokens[i].start, tokens[i].end,
@@ -516,3 +685,62 @@ auto Lemmatizer::tag(const LatinRnnModel& tagging_model,
 	}
 	return ret;
 }
+
+auto Lemmatizer::tag(const LatinRnnModel& tagging_model, 
+	const string& str, size_t beam_size, 
+	bool bidirection) const -> vector<Candidate>
+{
+	LatinRnnModel::Workspace ws;
+	return tag(tagging_model, str, beam_size, bidirection, ws);
+}
+
+auto Lemmatizer::tag(const LatinRnnModel& tagging_model,
+	const string& str, size_t beam_size,
+	bool bidirection, LatinRnnModel::Workspace& ws,
+	const BeamPruning& pruning, Marginals* marginals) const -> vector<Candidate>
+{
+	beam_size = max(beam_size, (size_t)1);
+	auto tokens = lemmatize(str);
+	vector<size_t> cand_tokens;
+	LatinRnnModel::Marginals step_marginals;
+	auto results = tagging_model.decode(ws, tokens.size(), beam_size, [&](size_t t, const RnnCell::Output& r, vector<LatinRnnModel::Candidate>& ret)
+	{
+		select_candidates(tagging_model, str, tokens[t], beam_size, r, cand_tokens, ret);
+	}, bidirection, pruning, marginals ? &step_marginals : nullptr);
+	return to_candidates(results, tokens, step_marginals, marginals);
+}
+
+TagSession::TagSession(const Lemmatizer& _lemmatizer, const LatinRnnModel& _tagging_model,
+	size_t _beam_size, bool _bidirection, const BeamPruning& _pruning)
+	: lemmatizer{ _lemmatizer }, tagging_model{ _tagging_model },
+	beam_size{ max(_beam_size, (size_t)1) }, bidirection{ _bidirection }, pruning{ _pruning }
+{
+	ws.keep_beam_states();
+}
+
+auto TagSession::tag(const string& str, Lemmatizer::Marginals* marginals) -> vector<Lemmatizer::Candidate>
+{
+	auto new_tokens = lemmatizer.lemmatize(str);
+	// the candidates of a token only depend on its form, so the steps before the first changed form are decoded as before
+	size_t begin = 0;
+	while (begin < decoded && begin < new_tokens.size()
+		&& text.compare(tokens[begin].start, tokens[begin].end - tokens[begin].start,
+			str, new_tokens[begin].start, new_tokens[begin].end - new_tokens[begin].start) == 0)
+	{
+		++begin;
+	}
+	text = str;
+	tokens = move(new_tokens);
+	// `decoded` stays at `begin` if decoding throws, so that the next call does not trust the broken steps
+	decoded = min(decoded, begin);
+	resumed_from = begin;
+
+	vector<size_t> cand_tokens;
+	LatinRnnModel::Marginals step_marginals;
+	auto results = tagging_model.decode_from(ws, begin, tokens.size(), beam_size, [&](size_t t, const RnnCell::Output& r, vector<LatinRnnModel::Candidate>& ret)
+	{
+		select_candidates(tagging_model, text, tokens[t], beam_size, r, cand_tokens, ret);
+	}, bidirection, pruning, marginals ? &step_marginals : nullptr);
+	decoded = tokens.size();
+	return to_candidates(results, tokens, step_marginals, marginals);
+}
@@ -78,14 +78,77 @@ namespace lamon
 			return lemma_pos[lemma_id];
 		}
 
+		size_t get_num_lemmas() const
+		{
+			return lemmas.size();
+		}
+
 		void save_model(std::ostream& ostr) const;
 		void load_model(std::istream& istr);
 
 		std::vector<TokenInfo> lemmatize(const char* str, size_t len) const;
 		std::vector<TokenInfo> lemmatize(const std::string& str) const;
 
+		/*
+		* splits `str` into sentences and returns their byte ranges, trimmed of spaces.
+		* Sentences end with `.`, `!`, `?` or `…` followed by a space, and at blank lines.
+		* A single period does not end a sentence after an abbreviation (initials, praenomina and common scholarly ones),
+		* nor after a numeral unless the next word is capitalized.
+		*/
+		static std::vector<std::pair<uint32_t, uint32_t>> split_sentences(const char* str, size_t len);
+		static std::vector<std::pair<uint32_t, uint32_t>> split_sentences(const std::string& str);
+
 		using Candidate = std::pair<float, std::vector<Token>>;
+
+		// the posterior probabilities of the candidates of each token, from the most probable
+		using Marginals = std::vector<std::vector<std::pair<float, LemmaInfo>>>;
+
 		std::vector<Candidate> tag(const LatinRnnModel& tagging_model, const std::string& str, 
 			size_t beam_size = 5, bool bidirection = true) const;
+
+		/*
+		* same as above, but decodes in the buffers of `ws`, which can be reused across calls of one thread, and prunes the beam by `pruning`.
+		* If `marginals` is given, it receives the posterior of each token's candidates computed from the same beam 
+		* (see `LatinRnnModel::decode`), so no extra decoding is needed for per-token confidences.
+		*/
+		std::vector<Candidate> tag(const LatinRnnModel& tagging_model, const std::string& str,
+			size_t beam_size, bool bidirection, LatinRnnModel::Workspace& ws,
+			const BeamPruning& pruning = {}, Marginals* marginals = nullptr) const;
+	};
+
+	/*
+	* A sentence tagged repeatedly while it is being edited. It keeps the beam and the forward LSTM states at every token,
+	* so that tagging the edited sentence resumes the search from its first changed token 
+	* and only the backward rescoring runs over the whole sentence. The results are the same as those of `Lemmatizer::tag`.
+	* `lemmatizer` and `tagging_model` must outlive the session, which is not thread-safe.
+	*/
+	class TagSession
+	{
+		const Lemmatizer& lemmatizer;
+		const LatinRnnModel& tagging_model;
+		size_t beam_size;
+		bool bidirection;
+		BeamPruning pruning;
+		LatinRnnModel::Workspace ws;
+		std::string text;
+		std::vector<Lemmatizer::TokenInfo> tokens;
+		// the number of leading tokens of `text` whose steps are kept in `ws`
+		size_t decoded = 0;
+		size_t resumed_from = 0;
+
+	public:
+		TagSession(const Lemmatizer& _lemmatizer, const LatinRnnModel& _tagging_model,
+			size_t _beam_size = 5, bool _bidirection = true, const BeamPruning& _pruning = {});
+
+		TagSession(const TagSession&) = delete;
+		TagSession& operator=(const TagSession&) = delete;
+
+		// tags `str`, reusing the steps of the previous call up to the first token that differs from it
+		std::vector<Lemmatizer::Candidate> tag(const std::string& str, Lemmatizer::Marginals* marginals = nullptr);
+
+		// returns the index of the first token decoded by the last `tag`, i.e. the number of tokens it reused
+		size_t get_resumed_from() const { return resumed_from; }
+
+		const std::string& get_text() const { return text; }
 	};
 }
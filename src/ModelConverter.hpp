@@ -0,0 +1,228 @@
+#pragma once
+
+#include <fstream>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <string>
+
+#include "rfobject.hpp"
+#include "kernels.hpp"
+#include "layers.hpp"
+#include "RnnModel.hpp"
+
+namespace lamon
+{
+    struct ConvertOption
+    {
+        // stores every `*/kernel:0` matrix as int8 with a per-output-channel scale
+        bool quantize_int8 = false;
+
+        // storage of `*_embedding:0` tables
+        StorageType embedding_storage = StorageType::fp32;
+
+        /*
+        * the number of most frequent tokens whose embedding half of the joint token-feature layer
+        * is precomputed and stored as `intermediate_feature_proj/token_part:0` of each direction. 
+        * `(size_t)-1` stores it for the whole vocabulary.
+        */
+        size_t precompute_joint_tokens = 0;
+
+        /*
+        * if nonzero, the fp32 kernels of each direction are also stored repacked into panels as `kernel_p16:0` objects, 
+        * covering the first `pack_panels` columns of the token projection (see `RnnCell::pack_panels`).
+        * It cannot be combined with `quantize_int8`.
+        */
+        size_t pack_panels = 0;
+
+        /*
+        * 2 writes an index ahead of the tensors and lays them out in the order decoding uses them.
+        * 1 writes the older sequence of RFMF records.
+        */
+        int format_version = 2;
+    };
+
+    namespace detail
+    {
+        inline bool ends_with(const std::string& str, const std::string& suffix)
+        {
+            return str.size() >= suffix.size() && std::equal(suffix.rbegin(), suffix.rend(), str.rbegin());
+        }
+
+        inline void write_quantized(utils::ObjectWriter& writer, const std::string& name, const utils::Object& obj)
+        {
+            const std::string prefix = name.substr(0, name.size() - std::string{ "kernel:0" }.size());
+            auto m = obj.to_matrix<float>();
+            std::vector<int8_t> q(m.size());
+            std::vector<float> scale(m.cols());
+            for (Eigen::Index j = 0; j < m.cols(); ++j)
+            {
+                const float absmax = kernels::absmax(m.col(j).data(), m.rows());
+                scale[j] = absmax > 0 ? absmax / 127 : 1;
+                kernels::quantize_s8(m.col(j).data(), m.rows(), 1 / scale[j], &q[j * m.rows()]);
+            }
+            writer.add(prefix + "kernel_q8:0", obj.shape(), q.data(), q.size() * sizeof(int8_t));
+            writer.add(prefix + "kernel_scale:0", { obj.shape()[1] }, scale.data(), scale.size() * sizeof(float));
+        }
+
+        inline void write_half(utils::ObjectWriter& writer, const std::string& name, const utils::Object& obj, StorageType storage)
+        {
+            const std::string prefix = name.substr(0, name.size() - 2);
+            const float* src = obj.ptr<float>();
+            std::vector<uint16_t> h(obj.num_elements());
+            for (size_t i = 0; i < h.size(); ++i)
+            {
+                h[i] = storage == StorageType::fp16 ? kernels::fp32_to_fp16(src[i]) : kernels::fp32_to_bf16(src[i]);
+            }
+            writer.add(prefix + (storage == StorageType::fp16 ? "_f16:0" : "_bf16:0"), obj.shape(), h.data(), h.size() * sizeof(uint16_t));
+        }
+
+        inline void write_joint_token_part(utils::ObjectWriter& writer, const utils::ObjectCollection& objs, const std::string& key, size_t size)
+        {
+            const Dense joint{ objs, key + "/intermediate_feature_proj" };
+            const EmbeddingLookup embs{ objs, "emb/token_embedding" };
+            size = std::min(size, embs.get_vocab_size());
+            Eigen::MatrixXf part(joint.output_size(), size);
+            RnnCell::compute_joint_token_part(part, joint, embs);
+            writer.add(key + "/intermediate_feature_proj/token_part:0",
+                { (uint32_t)part.rows(), (uint32_t)part.cols() }, part.data(), part.size() * sizeof(float));
+        }
+
+        // packs the cell `key` as it is loaded, so that the panels of the LSTM follow the gates as they are written
+        inline void write_panels(utils::ObjectWriter& writer, const utils::ObjectCollection& objs, const std::string& key, size_t token_cols)
+        {
+            RnnCell cell{ objs, key, token_cols };
+            cell.pack_panels();
+            cell.write_panels(writer, key);
+        }
+
+        /*
+        * the rank of a tensor in the order one decoding step uses it: the input embeddings,
+        * then the forward and the backward cell, each from its LSTM to its output layers.
+        */
+        inline size_t decode_order(const std::string& name)
+        {
+            static const char* directions[] = { "emb/", "lm/", "lm_bw/" };
+            static const char* stages[] = { "_embedding", "/lstm_cell/", "/LayerNorm/", "/output_token_proj/", "/intermediate_feature_proj/", "/output_feature_" };
+            size_t d = 0, st = 0;
+            while (d < 3 && name.compare(0, std::strlen(directions[d]), directions[d])) ++d;
+            while (st < 6 && name.find(stages[st]) == name.npos) ++st;
+            return d * 8 + st;
+        }
+
+        inline size_t element_size(const std::string& name)
+        {
+            if (ends_with(name, "_q8:0")) return sizeof(int8_t);
+            if (ends_with(name, "_f16:0") || ends_with(name, "_bf16:0")) return sizeof(uint16_t);
+            return sizeof(float);
+        }
+
+        // returns `data` whose columns of `col_size` bytes are moved to their places in the interleaved gates of `gate_size` units
+        inline std::vector<char> interleave_columns(const char* data, size_t num_cols, size_t col_size, size_t gate_size)
+        {
+            std::vector<char> ret(num_cols * col_size);
+            for (size_t j = 0; j < num_cols; ++j)
+            {
+                std::memcpy(&ret[LSTMCell::interleaved_index(j, gate_size) * col_size], data + j * col_size, col_size);
+            }
+            return ret;
+        }
+
+        /*
+        * rewrites the gates of the LSTM `key` in `objs` interleaved (see `LSTMCell`), along with the `kernel_il:0` mark.
+        * Cells already marked, and those whose size is not a multiple of `LSTMCell::gate_block`, are left as they are.
+        */
+        inline void interleave_lstm(utils::ObjectCollection& objs, const std::string& key)
+        {
+            if (!objs.count(key + "/bias:0") || objs.count(key + "/kernel_il:0")) return;
+            const auto& bias = objs[key + "/bias:0"];
+            const size_t m = bias.num_elements(), gate_size = m / 4;
+            if (m % 4 || gate_size % LSTMCell::gate_block) return;
+
+            for (auto& name : { "/kernel:0", "/kernel_q8:0", "/bias:0", "/kernel_scale:0" })
+            {
+                if (!objs.count(key + name)) continue;
+                const auto& obj = objs[key + name];
+                if (obj.shape().empty() || obj.shape().back() != m) throw exc::ShapeMismatch{ "wrong shape of " + key + name };
+                const size_t col_size = obj.num_elements() / m * element_size(key + name);
+                const auto data = interleave_columns(obj.ptr<char>(), m, col_size, gate_size);
+                const auto shape = obj.shape();
+                objs.put_copy(key + name, shape, data.data(), data.size());
+            }
+            const uint32_t block = LSTMCell::gate_block;
+            objs.put_copy(key + "/kernel_il:0", { 1 }, &block, sizeof(block));
+        }
+    }
+
+    /*
+    * rewrites the tagger file at `src_path` into `dst_path` applying `option`, with the gates of its LSTMs interleaved.
+    * Tensors are written in the same order as the source file, followed by the precomputed ones,
+    * and then reordered by `detail::decode_order` in the v2 format.
+    */
+    inline void convert_model(const std::string& src_path, const std::string& dst_path, const ConvertOption& option)
+    {
+        if (option.format_version != 1 && option.format_version != 2) throw std::invalid_argument{ "`format_version` must be 1 or 2" };
+        if (option.pack_panels && option.quantize_int8) throw std::invalid_argument{ "`pack_panels` cannot be combined with int8 quantization" };
+        utils::MMap mmap{ src_path };
+        auto objs = utils::ObjectCollection::read_from(mmap);
+        utils::ObjectWriter writer;
+        for (auto& key : { "lm", "lm_bw" }) detail::interleave_lstm(objs, std::string{ key } + "/layer_0/rnn/lstm_cell");
+
+        for (auto& p : objs.sorted_by_offset())
+        {
+            auto& name = p.first;
+            auto& obj = p.second;
+            if (option.precompute_joint_tokens && detail::ends_with(name, "/token_part:0"))
+            {
+                // it is recomputed below
+                continue;
+            }
+            else if (option.pack_panels && (detail::ends_with(name, "/kernel_p16:0") || detail::ends_with(name, "/kernel_p16_cols:0")))
+            {
+                // so is this
+                continue;
+            }
+            else if (option.quantize_int8 && obj.shape().size() == 2 && detail::ends_with(name, "/kernel:0"))
+            {
+                detail::write_quantized(writer, name, obj);
+            }
+            else if (option.embedding_storage != StorageType::fp32 && detail::ends_with(name, "_embedding:0"))
+            {
+                detail::write_half(writer, name, obj, option.embedding_storage);
+            }
+            else
+            {
+                writer.add(name, obj.shape(), obj.ptr<char>(), obj.num_elements() * detail::element_size(name));
+            }
+        }
+
+        if (option.precompute_joint_tokens)
+        {
+            // computed from the source tensors, so that it stays in fp32 even if the kernels are quantized
+            for (auto& key : { "lm", "lm_bw" })
+            {
+                if (!objs.count(std::string{ key } + "/intermediate_feature_proj/bias:0")) continue;
+                detail::write_joint_token_part(writer, objs, key, option.precompute_joint_tokens);
+            }
+        }
+
+        if (option.pack_panels)
+        {
+            for (auto& key : { "lm", "lm_bw" }) detail::write_panels(writer, objs, key, option.pack_panels);
+        }
+
+        std::ofstream ofs{ dst_path, std::ios_base::binary };
+        if (!ofs) throw std::ios_base::failure{ "Cannot open '" + dst_path + "'" };
+        if (option.format_version == 2)
+        {
+            writer.sort_by(detail::decode_order);
+            writer.write_v2(ofs);
+        }
+        else
+        {
+            writer.write_v1(ofs);
+        }
+        if (!ofs) throw std::ios_base::failure{ "Writing '" + dst_path + "' failed" };
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdlib>
+#include <ios>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <climits>
+#endif
+
+namespace lamon
+{
+    // returns the absolute path of `path` with symbolic links resolved, so that one file always gets one name
+    inline std::string canonical_path(const std::string& path)
+    {
+#ifdef _WIN32
+        char buf[MAX_PATH];
+        if (!_fullpath(buf, path.c_str(), MAX_PATH) || GetFileAttributesA(buf) == INVALID_FILE_ATTRIBUTES)
+        {
+            throw std::ios_base::failure("Cannot open '" + path + "'");
+        }
+        return buf;
+#else
+        char buf[PATH_MAX];
+        if (!realpath(path.c_str(), buf)) throw std::ios_base::failure("Cannot open '" + path + "'");
+        return buf;
+#endif
+    }
+
+    /*
+    * A process-wide registry of immutable objects loaded from files, such as dictionaries and tagging models.
+    * It only keeps weak references, so an object is shared by everyone asking for the same key while anyone holds it
+    * and is freed with its last holder.
+    */
+    template<typename _Ty>
+    class ModelRegistry
+    {
+        std::map<std::string, std::weak_ptr<const _Ty>> entries;
+        std::mutex mtx;
+
+    public:
+        static ModelRegistry& global()
+        {
+            static ModelRegistry inst;
+            return inst;
+        }
+
+        /*
+        * returns the object registered under `key`, or registers the one built by `load()`, which returns a new `_Ty*`.
+        * `load` runs under the lock, so concurrent requests for the same key load it only once.
+        */
+        template<typename _Fn>
+        std::shared_ptr<const _Ty> get(const std::string& key, _Fn&& load)
+        {
+            std::lock_guard<std::mutex> lock{ mtx };
+            for (auto it = entries.begin(); it != entries.end(); )
+            {
+                if (it->second.expired()) it = entries.erase(it);
+                else ++it;
+            }
+
+            auto& entry = entries[key];
+            // the last holder may have released it since the sweep above
+            if (auto found = entry.lock()) return found;
+
+            std::shared_ptr<const _Ty> ret{ load() };
+            entry = ret;
+            return ret;
+        }
+
+        // returns the number of objects alive
+        size_t size()
+        {
+            std::lock_guard<std::mutex> lock{ mtx };
+            size_t n = 0;
+            for (auto& e : entries) n += !e.second.expired();
+            return n;
+        }
+    };
+}
@@ -5,8 +5,12 @@
 #define DOC_VARIABLE_EN(name, en) PyDoc_STRVAR(name, en)
 
 DOC_SIGNATURE_EN(Lamon___init____doc__,
-	"Lamon(dict_path='dict.bin', tagger_path='tagger.bin', approx_size=2048)",
+	"Lamon(dict_path='dict.bin', tagger_path='tagger.bin', approx_size=2048, input_cache_size=4096, normalizer_rank=0, cache_size=0, populate=False, madvise='normal', hugepages=False, pack_weights=False)",
 	u8R""(`Lamon` provides Latin POS tagger & lemmatizer.
+The dictionary and the tagger model are loaded once per process and shared by every `Lamon` object 
+created with the same files and options, so creating more objects (e.g. one per thread) costs little.
+They are freed along with the last object using them.
+`tag` and `list_candidates` release the GIL while tagging, so one object can be used by several Python threads at once.
 
 Parameters
 ----------
@@ -15,8 +19,51 @@ dict_path : str
 tagger_path : str
 
 approx_size : int
+
+input_cache_size : int
+    the maximum number of decoded (lemma, tag) outputs per direction 
+    whose projection into the LSTM input gates is cached and shared across threads.
+    Each entry takes `16 * hidden_size` bytes. Set it to 0 to disable the cache.
+
+normalizer_rank : int
+    if nonzero, the softmax normalizer over the `approx_size` most frequent tokens
+    is computed from a factorization of the token projection with this rank.
+    It makes tagging faster at the cost of accuracy. 0 computes the normalizer exactly.
+
+cache_size : int
+    the maximum number of sentences whose tagging results are kept in a least-recently-used cache,
+    shared by `tag` and `tag_multi`. Repeated sentences are then returned without decoding. 0 disables it.
+    See `cache_info()` for its statistics.
+
+populate : bool
+    reads the whole tagger model into memory while loading it, 
+    so that the first sentences are not slowed down by page faults.
+
+madvise : str
+    the expected access pattern of the tagger model, passed to `madvise` on POSIX systems. 
+    One of `'normal'`, `'sequential'` and `'willneed'`. It is ignored on Windows.
+
+hugepages : bool
+    copies the tagger model into memory backed by transparent hugepages where Linux provides them,
+    which reduces TLB misses while tagging. The copy is private to this object, 
+    unlike the default mapping shared by all processes loading the same file. It is ignored on Windows.
+
+pack_weights : bool
+    repacks the LSTM, the joint lemma-tag layer and the `approx_size` columns of the token projection 
+    into blocks of 16 columns laid out row by row, which the matrix-vector products stream through without horizontal sums.
+    It makes tagging faster and loading slower, and takes another copy of those weights. 
+    Scores may differ in the last digits from those without it. Tensors packed by `convert_tagger(pack_panels=...)` are used without it.
 )"");
 
+DOC_VARIABLE_EN(Lamon_load_times__doc__,
+	u8R""(a `dict` of the milliseconds spent in each stage of loading: `dictionary`, `map` (mapping the tagger model), 
+`parse`, `layers`, `precompute`, and their `total` (read-only). 
+The times are those of the first load when the files are shared with another `Lamon` object.)"");
+
+DOC_VARIABLE_EN(Lamon_average_beam_width__doc__,
+	u8R""(the average number of beam paths advanced per token in all `tag` and `tag_multi` calls so far (read-only).
+It shows how much `beam_margin` and `candidate_margin` narrow the beam.)"");
+
 DOC_SIGNATURE_EN(Lamon_list_candidates__doc__,
 	"tag(self, text, tag_style='perseus')",
 	u8R""(tokenizes `text` and finds candidates of lemma-tag pairs for each token.
@@ -33,7 +80,7 @@ candidates : List[Tuple[Int, Int, Tag]]
 )"");
 
 DOC_SIGNATURE_EN(Lamon_tag__doc__,
-	"tag(self, text, tag_style='perseus', beam_size=1, bidirection=True)",
+	"tag(self, text, tag_style='perseus', beam_size=1, bidirection=True, search_beam_size=10, beam_margin=inf, candidate_margin=inf, marginals=False)",
 	u8R""(tokenizes `text` and labels the token sequence by deep model.
 Parameters
 ----------
@@ -42,16 +89,37 @@ text : str
 tag_style : str
 
 beam_size : int
+    the number of results returned
 
 bidirection : bool
 
+search_beam_size : int
+    the width of the beam searched while decoding. The best `max(beam_size, search_beam_size)` paths are kept at each step,
+    so the results are ranked among that many paths. `1` runs a greedy decoder, which is the fastest.
+
+beam_margin : float
+    paths scoring more than `beam_margin` nats below the best path are dropped from the beam, 
+    so that the beam narrows where one path dominates. The default `inf` always keeps `search_beam_size` paths.
+
+candidate_margin : float
+    candidates of a token scoring more than `candidate_margin` nats below the best one of the same path are not expanded.
+
+marginals : bool
+    if True, also returns the posterior probability of each token's candidates, computed from the same beam.
+    The complete paths kept by the beam are weighted by the softmax of their scores, 
+    and each candidate receives the weights of the paths choosing it, so candidates the beam dropped get none.
+    A `search_beam_size` of 1 gives the best path a probability of 1.
+
 Return
 ------
 result : List[Tuple[float, TaggedSequence]]
+    or `(result, marginals)` if `marginals` is True, where `marginals` is 
+    `List[Tuple[int, int, List[Tuple[str, str]], numpy.ndarray]]` of `(start, end, candidates, probs)` for each token.
+    `candidates` are `(lemma, tag)` in `tag_style` from the most probable, and `probs` is a float32 array of their probabilities.
 
 )"");
 DOC_SIGNATURE_EN(Lamon_tag_multi__doc__,
-	"tag_multi(self, texts, tag_style='perseus', beam_size=1, bidirection=True, num_workers=0)",
+	"tag_multi(self, texts, tag_style='perseus', beam_size=1, bidirection=True, num_workers=0, search_beam_size=10, beam_margin=inf, candidate_margin=inf, max_in_flight=None, ordered=True)",
 	u8R""(tokenizes multiple `texts` and labels the token sequences by deep model. It runs on `num_workers` threads.
 Parameters
 ----------
@@ -60,13 +128,207 @@ texts : Iterable[str]
 tag_style : str
 
 beam_size : int
+    the number of results returned for each text
 
 bidirection : bool
 
 num_workers : int
 
+search_beam_size : int
+    the width of the beam searched while decoding. The best `max(beam_size, search_beam_size)` paths are kept at each step,
+    so the results are ranked among that many paths. `1` runs a greedy decoder, which is the fastest.
+
+beam_margin : float
+    paths scoring more than `beam_margin` nats below the best path are dropped from the beam, 
+    so that the beam narrows where one path dominates. The default `inf` always keeps `search_beam_size` paths.
+
+candidate_margin : float
+    candidates of a token scoring more than `candidate_margin` nats below the best one of the same path are not expanded.
+
+max_in_flight : int
+    if given, `texts` is read lazily while the results are iterated, 
+    keeping at most `max_in_flight` texts being tagged or waiting to be returned, so that the memory stays bounded on inputs of any length.
+    An error raised by `texts` is then raised by the iteration. It must be positive. `None` (default) reads the whole `texts` at once.
+
+ordered : bool
+    if False, the results are returned as `(index, result)` as soon as any of them is tagged, 
+    where `index` is the position of the text in `texts`, so that a long text does not hold back those after it.
+
 Return
 ------
 results : Iterable[List[Tuple[float, TaggedSequence]]]
+    the results in the order of `texts`, or `Iterable[Tuple[int, List[Tuple[float, TaggedSequence]]]]` in the order they are finished if `ordered` is False.
+    Each of them is released once it is returned.
+
+)"");
+DOC_SIGNATURE_EN(Lamon_tag_document__doc__,
+	"tag_document(self, text, tag_style='perseus', beam_size=1, bidirection=True, num_workers=0, search_beam_size=10, beam_margin=inf, candidate_margin=inf)",
+	u8R""(splits `text` into sentences and labels each of them by deep model on `num_workers` threads.
+Sentences end with `.`, `!`, `?` or `…` followed by a space, and at blank lines. 
+A period after an abbreviation (e.g. `M.`, `Cn.`, `cos.`) or after a numeral followed by a lowercase word does not end a sentence.
+Parameters
+----------
+text : str
+
+tag_style : str
 
-)"");
\ No newline at end of file
+beam_size : int
+    the number of results returned for each sentence
+
+bidirection : bool
+
+num_workers : int
+
+search_beam_size : int
+
+beam_margin : float
+
+candidate_margin : float
+    the same as those of `tag`
+
+Return
+------
+sentences : List[Tuple[int, int, List[Tuple[float, TaggedSequence]]]]
+    `(start, end, results)` of each sentence in order. All positions are offsets into `text`.
+)"");
+DOC_SIGNATURE_EN(Lamon_tag_arrays__doc__,
+	"tag_arrays(self, texts, bidirection=True, num_workers=0, search_beam_size=10, beam_margin=inf, candidate_margin=inf)",
+	u8R""(labels multiple `texts` as `tag_multi` does, and returns the best result of every text as NumPy arrays rather than Python objects,
+which is much faster to build and to keep for large inputs. The tokens of all texts are concatenated in the order of `texts`.
+Lemmas and tags are returned as codes, which `decode_lemmas` and `decode_tags` turn into strings.
+Parameters
+----------
+texts : Iterable[str]
+
+bidirection : bool
+
+num_workers : int
+
+search_beam_size : int
+
+beam_margin : float
+
+candidate_margin : float
+    the same as those of `tag_multi`
+
+Return
+------
+arrays : Dict[str, numpy.ndarray]
+    `offsets` (int64): the tokens of the `i`-th text are `offsets[i]:offsets[i + 1]`, so it has `len(texts) + 1` elements
+    `start`, `end` (uint32): the positions of each token in its text
+    `lemma_id` (uint32): the lemma of each token, which `decode_lemmas` decodes
+    `feature` (uint64): the morphological features of each token packed into the bytes of 
+    mood, tense, voice, person, gender, number, case and degree from the lowest, as in the `raw` style. `feature.view(numpy.uint8).reshape(-1, 8)` unpacks them.
+    `pos` (uint8): the code of the part of speech of each lemma, as an ASCII letter or 0
+    `score` (float32): the score of each text
+)"");
+DOC_SIGNATURE_EN(Lamon_decode_lemmas__doc__,
+	"decode_lemmas(self, lemma_ids)",
+	u8R""(returns the lemmas of `lemma_ids` from `tag_arrays` as a list of str.
+Parameters
+----------
+lemma_ids : Iterable[int]
+    an array or a sequence of lemma ids, e.g. `tag_arrays(...)['lemma_id']` or a part of it
+
+Return
+------
+lemmas : List[str]
+)"");
+DOC_SIGNATURE_EN(Lamon_decode_tags__doc__,
+	"decode_tags(self, features, pos=None, tag_style='perseus')",
+	u8R""(returns the tags of `features` and `pos` from `tag_arrays` as a list of str.
+Parameters
+----------
+features : Iterable[int]
+
+pos : Iterable[int]
+    required for 'perseus' tags, which begin with the part of speech
+
+tag_style : str
+    'perseus' or 'vivens'
+
+Return
+------
+tags : List[str]
+)"");
+DOC_SIGNATURE_EN(Lamon_session__doc__,
+	"session(self, beam_size=1, bidirection=True, search_beam_size=10, beam_margin=inf, candidate_margin=inf)",
+	u8R""(creates a `LamonSession` for tagging a sentence repeatedly while it is being edited, e.g. in an annotation editor.
+The parameters are the same as those of `tag` and apply to every `LamonSession.tag`.
+
+Return
+------
+session : LamonSession
+
+)"");
+DOC_VARIABLE_EN(LamonSession__doc__,
+	u8R""(`LamonSession` tags successive versions of one sentence, created by `Lamon.session()`.
+It keeps the beam of the last tagged version at every token, so tagging an edited version resumes the search 
+from its first changed token, and only the backward rescoring runs over the whole sentence.
+The time of a call thus grows with the number of tokens after the edit rather than with the sentence length,
+and the results are the same as those of `Lamon.tag`.
+`tag` releases the GIL while tagging, but the calls of one session from several threads run one at a time. A `Lamon` object can have any number of sessions.)"");
+
+DOC_SIGNATURE_EN(LamonSession_tag__doc__,
+	"tag(self, text, tag_style='perseus', marginals=False)",
+	u8R""(tags `text`, reusing the tokens before the first one that differs from the `text` of the previous call.
+Parameters
+----------
+text : str
+
+tag_style : str
+
+marginals : bool
+    the same as those of `Lamon.tag`
+
+Return
+------
+result : List[Tuple[float, TaggedSequence]]
+    or `(result, marginals)` if `marginals` is True, as `Lamon.tag` returns
+)"");
+
+DOC_VARIABLE_EN(LamonSession_resumed_from__doc__,
+	u8R""(the index of the first token decoded by the last `tag`, i.e. the number of tokens reused from the previous call (read-only).)"");
+
+DOC_SIGNATURE_EN(Lamon_cache_info__doc__,
+	"cache_info(self)",
+	u8R""(returns the statistics of the sentence cache enabled by `cache_size` as a dict of
+`hits`, `misses`, `size` (the number of cached sentences) and `capacity`.
+)"");
+DOC_SIGNATURE_EN(Lamon_cache_clear__doc__,
+	"cache_clear(self)",
+	u8R""(empties the sentence cache and resets its statistics.
+)"");
+DOC_SIGNATURE_EN(convert_tagger__doc__,
+	"convert_tagger(src_path, dst_path, quantize=None, embedding_storage='fp32', precompute_joint=0, format_version=2, pack_panels=0)",
+	u8R""(converts the tagger model file at `src_path` and writes the result into `dst_path`.
+Parameters
+----------
+src_path : str
+
+dst_path : str
+
+quantize : str
+    None or 'int8'. With 'int8', every dense kernel is stored as int8 with a scale per output channel,
+    which shrinks the file and lets `Lamon` run integer dot-product kernels.
+
+embedding_storage : str
+    'fp32', 'fp16' or 'bf16'. Half-precision storage halves the size of the token and feature embedding tables.
+    Their columns are expanded into fp32 (with F16C if available) when they are gathered.
+
+precompute_joint : int
+    the number of most frequent tokens whose embedding half of the joint lemma-tag layer is precomputed and stored in the file,
+    or -1 for the whole vocabulary. Without it, `Lamon` precomputes it for the `approx_size` most frequent tokens on loading.
+
+format_version : int
+    2 (default) writes an index of the tensors at the head of the file, which `Lamon` reads without scanning the whole file,
+    and lays the tensors out aligned in the order tagging uses them. 1 writes the format of older versions.
+    Both formats are read by `Lamon`.
+
+pack_panels : int
+    if nonzero, also stores the weights repacked as with `Lamon(pack_weights=True)`, 
+    covering the `pack_panels` most frequent tokens of the token projection (usually `approx_size`), 
+    so that `Lamon` skips repacking on loading. It cannot be combined with `quantize`.
+
+A converted file can be loaded with `Lamon(tagger_path=dst_path)` as usual.
+)"");
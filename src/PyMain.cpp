@@ -1,12 +1,21 @@
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
 #define MAIN_MODULE
 #include "PyDoc.h"
 #include "PyUtils.h"
 #include "text.hpp"
 #include "RnnModel.hpp"
 #include "Lemmatizer.h"
+#include "ModelConverter.hpp"
 #include "ThreadPool.hpp"
+#include "TagCache.hpp"
+#include "ModelRegistry.hpp"
 
 
 PyObject* gModule;
@@ -21,24 +30,73 @@ string get_module_filename(PyObject* module)
 	return spath;
 }
 
+// a dictionary shared through `lamon::ModelRegistry`, with the time it took to load
+struct LoadedDictionary
+{
+	lamon::Lemmatizer lemmatizer;
+	double load_ms = 0;
+};
+
+// returns the canonical path of `path`, looked up in the working directory first and in `module_dir` next
+static string find_model_file(const string& path, const string& module_dir)
+{
+	try
+	{
+		return lamon::canonical_path(path);
+	}
+	catch (const ios_base::failure&)
+	{
+	}
+	try
+	{
+		return lamon::canonical_path(module_dir + path);
+	}
+	catch (const ios_base::failure&)
+	{
+		throw runtime_error{ "Cannot find '" + module_dir + path + "'" };
+	}
+}
+
 struct LamonObject
 {
 	PyObject_HEAD;
-	lamon::Lemmatizer lemmatizer;
-	lamon::LatinRnnModel* rnn_model;
+	// immutable, and shared with the other objects loading the same files with the same options
+	shared_ptr<const lamon::Lemmatizer> lemmatizer;
+	shared_ptr<const lamon::LatinRnnModel> rnn_model;
 	ThreadPool* pool;
+	// decoding buffers of `tag`, one per Python thread tagging at the same time, and the idle ones among them
+	list<lamon::LatinRnnModel::Workspace> workspaces;
+	vector<lamon::LatinRnnModel::Workspace*> idle_workspaces;
+	mutex workspace_mtx;
+	// decoding buffers of each worker of `pool`, reused across calls
+	deque<lamon::LatinRnnModel::Workspace> worker_workspaces;
+	// results of recent sentences, null if disabled
+	lamon::TagCache* tag_cache;
+	// milliseconds spent loading the dictionary when it was first loaded
+	double dict_load_ms;
 
 	static int init(LamonObject* self, PyObject* args, PyObject* kwargs)
 	{
-		new (&self->lemmatizer) lamon::Lemmatizer{};
-		self->rnn_model = nullptr;
+		new (&self->lemmatizer) shared_ptr<const lamon::Lemmatizer>{};
+		new (&self->rnn_model) shared_ptr<const lamon::LatinRnnModel>{};
+		new (&self->workspaces) list<lamon::LatinRnnModel::Workspace>{};
+		new (&self->idle_workspaces) vector<lamon::LatinRnnModel::Workspace*>{};
+		new (&self->workspace_mtx) mutex{};
+		new (&self->worker_workspaces) deque<lamon::LatinRnnModel::Workspace>{};
 		self->pool = nullptr;
+		self->tag_cache = nullptr;
+		self->dict_load_ms = 0;
 		const char* dict_path = "dict.bin";
 		const char* tagger_path = "tagger.bin";
 		size_t approx_size = 2048;
-		static const char* kwlist[] = { "dict_path", "tagger_path", "approx_size", nullptr };
-		if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ssi", (char**)kwlist, 
-			&dict_path, &tagger_path, &approx_size)) return -1;
+		Py_ssize_t input_cache_size = 4096, normalizer_rank = 0, cache_size = 0;
+		int populate = 0, hugepages = 0, pack_weights = 0;
+		const char* madvise = "normal";
+		static const char* kwlist[] = { "dict_path", "tagger_path", "approx_size", "input_cache_size", "normalizer_rank", "cache_size", 
+			"populate", "madvise", "hugepages", "pack_weights", nullptr };
+		if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ssinnnpspp", (char**)kwlist, 
+			&dict_path, &tagger_path, &approx_size, &input_cache_size, &normalizer_rank, &cache_size,
+			&populate, &madvise, &hugepages, &pack_weights)) return -1;
 		try
 		{
 			
@@ -56,26 +114,36 @@ struct LamonObject
 				PyErr_Clear();
 			}
 
-			ifstream ifs{ dict_path, ios_base::binary };
-			if (!ifs)
+			const string dict_file = find_model_file(dict_path, spath);
+			auto dict = lamon::ModelRegistry<LoadedDictionary>::global().get(dict_file, [&]()
 			{
-				ifstream ifs{ spath + dict_path, ios_base::binary };
-				if (!ifs) throw runtime_error{ string{"Cannot find '"} + spath + dict_path + "'" };
-				self->lemmatizer.load_model(ifs);
-			}
-			else
-			{
-				self->lemmatizer.load_model(ifs);
-			}
+				const auto start = chrono::steady_clock::now();
+				unique_ptr<LoadedDictionary> ret{ new LoadedDictionary };
+				ifstream ifs{ dict_file, ios_base::binary };
+				if (!ifs) throw runtime_error{ "Cannot find '" + dict_file + "'" };
+				ret->lemmatizer.load_model(ifs);
+				ret->load_ms = chrono::duration<double, milli>{ chrono::steady_clock::now() - start }.count();
+				return ret.release();
+			});
+			self->lemmatizer = shared_ptr<const lamon::Lemmatizer>{ dict, &dict->lemmatizer };
+			self->dict_load_ms = dict->load_ms;
 			
-			try
+			if (input_cache_size < 0) throw runtime_error{ "`input_cache_size` must be non-negative" };
+			if (normalizer_rank < 0) throw runtime_error{ "`normalizer_rank` must be non-negative" };
+			if (cache_size < 0) throw runtime_error{ "`cache_size` must be non-negative" };
+			if (cache_size) self->tag_cache = new lamon::TagCache{ (size_t)cache_size };
+			lamon::utils::MMapOption mmap_option{ !!populate, lamon::utils::MMapOption::Advice::normal, !!hugepages };
+			if (madvise == string{ "sequential" }) mmap_option.advice = lamon::utils::MMapOption::Advice::sequential;
+			else if (madvise == string{ "willneed" }) mmap_option.advice = lamon::utils::MMapOption::Advice::willneed;
+			else if (madvise != string{ "normal" }) throw runtime_error{ "`madvise` must be one of 'normal', 'sequential', 'willneed'" };
+			lamon::ModelOption option{ approx_size, (size_t)input_cache_size, (size_t)normalizer_rank, mmap_option, !!pack_weights };
+			const string tagger_file = find_model_file(tagger_path, spath);
+			const string key = tagger_file + '\n' + to_string(approx_size) + ',' + to_string(input_cache_size) + ',' + to_string(normalizer_rank)
+				+ ',' + to_string(populate) + ',' + to_string((int)mmap_option.advice) + ',' + to_string(hugepages) + ',' + to_string(pack_weights);
+			self->rnn_model = lamon::ModelRegistry<lamon::LatinRnnModel>::global().get(key, [&]()
 			{
-				self->rnn_model = new lamon::LatinRnnModel(tagger_path, approx_size);
-			}
-			catch (const std::ios_base::failure&)
-			{
-				self->rnn_model = new lamon::LatinRnnModel(spath + tagger_path, approx_size);
-			}
+				return new lamon::LatinRnnModel(tagger_file, option);
+			});
 		}
 		catch (const bad_exception&)
 		{
@@ -91,22 +159,141 @@ struct LamonObject
 
 	static void dealloc(LamonObject* self)
 	{
-		self->lemmatizer.~Lemmatizer();
-		if (self->rnn_model)
-		{
-			delete self->rnn_model;
-			self->rnn_model = nullptr;
-		}
+		// the workers may still be running with the models
 		if (self->pool)
 		{
 			delete self->pool;
 			self->pool = nullptr;
 		}
+		self->rnn_model.~shared_ptr<const lamon::LatinRnnModel>();
+		self->lemmatizer.~shared_ptr<const lamon::Lemmatizer>();
+		if (self->tag_cache)
+		{
+			delete self->tag_cache;
+			self->tag_cache = nullptr;
+		}
+		self->worker_workspaces.~deque();
+		self->workspace_mtx.~mutex();
+		self->idle_workspaces.~vector();
+		self->workspaces.~list();
 		Py_TYPE(self)->tp_free((PyObject*)self);
 	}
+
+	/*
+	* tags `text` with a beam of `max(beam_size, search_beam_size)` paths and returns the best `beam_size` results.
+	* Results are looked up in and stored into `tag_cache` by the searched width, so calls differing only in `beam_size` share them.
+	* The cache holds no marginals, so it is bypassed when `marginals` are requested.
+	*/
+	vector<lamon::Lemmatizer::Candidate> tag(const string& text, size_t beam_size, size_t search_beam_size, bool bidirection,
+		const lamon::BeamPruning& pruning, lamon::LatinRnnModel::Workspace& ws, lamon::Lemmatizer::Marginals* marginals = nullptr) const
+	{
+		const size_t searched = max(beam_size, search_beam_size);
+		vector<lamon::Lemmatizer::Candidate> ret;
+		if (marginals)
+		{
+			ret = lemmatizer->tag(*rnn_model, text, searched, bidirection, ws, pruning, marginals);
+		}
+		else if (tag_cache)
+		{
+			const lamon::TagCache::Key key{ text, searched, bidirection, pruning.path_margin, pruning.candidate_margin };
+			if (auto found = tag_cache->find(key))
+			{
+				ret.assign(found->begin(), found->begin() + min(beam_size, found->size()));
+				return ret;
+			}
+			ret = lemmatizer->tag(*rnn_model, text, searched, bidirection, ws, pruning);
+			tag_cache->insert(key, ret);
+		}
+		else
+		{
+			ret = lemmatizer->tag(*rnn_model, text, searched, bidirection, ws, pruning);
+		}
+		if (ret.size() > beam_size) ret.erase(ret.begin() + beam_size, ret.end());
+		return ret;
+	}
+
+	// takes an idle workspace for `tag`, or a new one if every workspace is in use by another thread
+	lamon::LatinRnnModel::Workspace& acquire_workspace()
+	{
+		lock_guard<mutex> lock{ workspace_mtx };
+		if (idle_workspaces.empty())
+		{
+			workspaces.emplace_back();
+			return workspaces.back();
+		}
+		auto ws = idle_workspaces.back();
+		idle_workspaces.pop_back();
+		return *ws;
+	}
+
+	void release_workspace(lamon::LatinRnnModel::Workspace& ws)
+	{
+		lock_guard<mutex> lock{ workspace_mtx };
+		idle_workspaces.emplace_back(&ws);
+	}
+
+	// a workspace taken by `acquire_workspace` for one call, given back when it goes out of scope
+	struct WorkspaceLease
+	{
+		LamonObject* owner;
+		lamon::LatinRnnModel::Workspace& ws;
+
+		~WorkspaceLease()
+		{
+			owner->release_workspace(ws);
+		}
+	};
+
+	// (re)creates `pool` with `num_workers` threads, or with one per core if it is 0
+	void prepare_pool(size_t num_workers)
+	{
+		if (!num_workers) num_workers = thread::hardware_concurrency();
+		if (pool && pool->getNumWorkers() == num_workers) return;
+		if (pool) delete pool;
+		pool = new ThreadPool{ num_workers };
+		worker_workspaces.clear();
+		for (size_t i = 0; i < num_workers; ++i) worker_workspaces.emplace_back();
+	}
 };
 
+static PyObject* Lamon_get_average_beam_width(LamonObject* self, void* closure)
+{
+	size_t steps = 0, path_steps = 0;
+	{
+		// the workspaces in use are skipped, since they may be updated meanwhile
+		lock_guard<mutex> lock{ self->workspace_mtx };
+		for (auto ws : self->idle_workspaces)
+		{
+			steps += ws->get_num_steps();
+			path_steps += ws->get_num_path_steps();
+		}
+	}
+	// the workers may be decoding meanwhile, which only the atomic counters allow
+	for (auto& ws : self->worker_workspaces)
+	{
+		steps += ws.get_num_steps();
+		path_steps += ws.get_num_path_steps();
+	}
+	return PyFloat_FromDouble(steps ? path_steps / (double)steps : 0.);
+}
+
+static PyObject* Lamon_get_load_times(LamonObject* self, void* closure)
+{
+	lamon::LatinRnnModel::LoadTimes t;
+	if (self->rnn_model) t = self->rnn_model->get_load_times();
+	return Py_BuildValue("{s:d,s:d,s:d,s:d,s:d,s:d}",
+		"dictionary", self->dict_load_ms,
+		"map", t.map,
+		"parse", t.parse,
+		"layers", t.layers,
+		"precompute", t.precompute,
+		"total", self->dict_load_ms + t.map + t.parse + t.layers + t.precompute
+	);
+}
+
 static PyGetSetDef Lamon_getseters[] = {
+	{ (char*)"average_beam_width", (getter)Lamon_get_average_beam_width, nullptr, Lamon_average_beam_width__doc__, nullptr },
+	{ (char*)"load_times", (getter)Lamon_get_load_times, nullptr, Lamon_load_times__doc__, nullptr },
 	{ nullptr },
 };
 
@@ -126,7 +313,9 @@ inline size_t count_uchars(const char* first, const char* last)
 	return n;
 }
 
-static PyObject* build_tagged_result(const vector<lamon::Lemmatizer::Candidate>& res, const lamon::Lemmatizer& lemmatizer, const string& text, const string& tag_style)
+// `text` starts at the character `chr_offset` of the original text, to which the positions in the result refer
+static PyObject* build_tagged_result(const vector<lamon::Lemmatizer::Candidate>& res, const lamon::Lemmatizer& lemmatizer, const string& text, const string& tag_style,
+	uint32_t chr_offset = 0)
 {
 	return py::buildPyValueTransform(res.begin(), res.end(), [&](const lamon::Lemmatizer::Candidate& c)
 	{
@@ -138,10 +327,10 @@ static PyObject* build_tagged_result(const vector<lamon::Lemmatizer::Candidate>&
 			{
 				if (bytes <= t.start) chrs += count_uchars(text.data() + bytes, text.data() + t.start);
 				else chrs = count_uchars(text.data(), text.data() + t.start);
-				uint32_t start = chrs;
+				uint32_t start = chr_offset + chrs;
 				bytes = t.start;
 				chrs += count_uchars(text.data() + bytes, text.data() + t.end);
-				uint32_t end = chrs;
+				uint32_t end = chr_offset + chrs;
 				bytes = t.end;
 
 				string tag;
@@ -154,10 +343,10 @@ static PyObject* build_tagged_result(const vector<lamon::Lemmatizer::Candidate>&
 			{
 				if (bytes <= t.start) chrs += count_uchars(text.data() + bytes, text.data() + t.start);
 				else chrs = count_uchars(text.data(), text.data() + t.start);
-				uint32_t start = chrs;
+				uint32_t start = chr_offset + chrs;
 				bytes = t.start;
 				chrs += count_uchars(text.data() + bytes, text.data() + t.end);
-				uint32_t end = chrs;
+				uint32_t end = chr_offset + chrs;
 				bytes = t.end;
 
 				return make_tuple(start, end, lemmatizer.get_lemma(t.lemma_id), lemmatizer.to_perseus_tag(t.feature, lemmatizer.get_pos(t.lemma_id)));
@@ -166,10 +355,10 @@ static PyObject* build_tagged_result(const vector<lamon::Lemmatizer::Candidate>&
 			{
 				if (bytes <= t.start) chrs += count_uchars(text.data() + bytes, text.data() + t.start);
 				else chrs = count_uchars(text.data(), text.data() + t.start);
-				uint32_t start = chrs;
+				uint32_t start = chr_offset + chrs;
 				bytes = t.start;
 				chrs += count_uchars(text.data() + bytes, text.data() + t.end);
-				uint32_t end = chrs;
+				uint32_t end = chr_offset + chrs;
 				bytes = t.end;
 
 				PyObject* f = PyDict_New();
@@ -188,6 +377,60 @@ static PyObject* build_tagged_result(const vector<lamon::Lemmatizer::Candidate>&
 	});
 }
 
+// returns the lemma and the tag of `info` formatted as in the results of `tag`, without the positions
+static PyObject* build_lemma_tag(const lamon::Lemmatizer::LemmaInfo& info, const lamon::Lemmatizer& lemmatizer, const string& tag_style)
+{
+	if (tag_style == "vivens")
+	{
+		string tag;
+		tag.push_back(lemmatizer.get_pos(info.lemma_id));
+		if (!tag.back()) tag.pop_back();
+		return py::buildPyValue(make_tuple(lemmatizer.get_lemma(info.lemma_id), tag, lemmatizer.to_vivens_tag(info.feature)));
+	}
+	if (tag_style == "perseus")
+	{
+		return py::buildPyValue(make_tuple(lemmatizer.get_lemma(info.lemma_id), lemmatizer.to_perseus_tag(info.feature, lemmatizer.get_pos(info.lemma_id))));
+	}
+	PyObject* f = PyDict_New();
+	py::setPyDictItem(f, "mood", info.feature.mood);
+	py::setPyDictItem(f, "tense", info.feature.tense);
+	py::setPyDictItem(f, "voice", info.feature.voice);
+	py::setPyDictItem(f, "person", info.feature.person);
+	py::setPyDictItem(f, "gender", info.feature.gender);
+	py::setPyDictItem(f, "number", info.feature.number);
+	py::setPyDictItem(f, "case", info.feature.case_);
+	py::setPyDictItem(f, "degree", info.feature.degree);
+	return py::buildPyValue(make_tuple(lemmatizer.get_lemma(info.lemma_id), f));
+}
+
+/*
+* returns `(start, end, candidates, probs)` per token, where `probs` is a float32 array of the posteriors of `candidates`.
+* `tokens` gives the positions of the tokens, which are those of any result of the same text.
+*/
+static PyObject* build_marginals(const lamon::Lemmatizer::Marginals& marginals, const vector<lamon::Lemmatizer::Token>& tokens,
+	const lamon::Lemmatizer& lemmatizer, const string& text, const string& tag_style)
+{
+	PyObject* ret = PyList_New(marginals.size());
+	size_t chrs = 0, bytes = 0;
+	for (size_t t = 0; t < marginals.size(); ++t)
+	{
+		chrs += count_uchars(text.data() + bytes, text.data() + tokens[t].start);
+		const uint32_t start = chrs;
+		chrs += count_uchars(text.data() + tokens[t].start, text.data() + tokens[t].end);
+		bytes = tokens[t].end;
+
+		auto& m = marginals[t];
+		PyObject* cands = py::buildPyValueTransform(m.begin(), m.end(), [&](const pair<float, lamon::Lemmatizer::LemmaInfo>& c)
+		{
+			return build_lemma_tag(c.second, lemmatizer, tag_style);
+		});
+		vector<float> probs;
+		for (auto& c : m) probs.emplace_back(c.first);
+		PyList_SetItem(ret, t, py::buildPyValue(make_tuple(start, (uint32_t)chrs, cands, py::buildPyValue(probs))));
+	}
+	return ret;
+}
+
 static PyObject* LL_list_candidates(LamonObject* self, PyObject* args, PyObject* kwargs)
 {
 	const char* text;
@@ -205,7 +448,12 @@ static PyObject* LL_list_candidates(LamonObject* self, PyObject* args, PyObject*
 			};
 		}
 
-		auto ret = self->lemmatizer.lemmatize(text);
+		vector<lamon::Lemmatizer::TokenInfo> ret;
+		{
+			const string utf8 = text;
+			py::ReleaseGIL nogil;
+			ret = self->lemmatizer->lemmatize(utf8);
+		}
 		size_t chrs = 0, bytes = 0;
 		return py::buildPyValueTransform(ret.begin(), ret.end(), [&](const lamon::Lemmatizer::TokenInfo& info)
 		{
@@ -228,15 +476,15 @@ static PyObject* LL_list_candidates(LamonObject* self, PyObject* args, PyObject*
 				py::buildPyValueTransform(info.lemma_cands.begin(), info.lemma_cands.end(), [&](const lamon::Lemmatizer::LemmaInfo& l)
 				{
 					string tag;
-					tag.push_back(self->lemmatizer.get_pos(l.lemma_id));
+					tag.push_back(self->lemmatizer->get_pos(l.lemma_id));
 					if (!tag.back()) tag.pop_back();
-					return make_tuple(self->lemmatizer.get_lemma(l.lemma_id), tag, self->lemmatizer.to_vivens_tag(l.feature));
+					return make_tuple(self->lemmatizer->get_lemma(l.lemma_id), tag, self->lemmatizer->to_vivens_tag(l.feature));
 				}) :
 				tag_style == "perseus" ?
 				py::buildPyValueTransform(info.lemma_cands.begin(), info.lemma_cands.end(), [&](const lamon::Lemmatizer::LemmaInfo& l)
 				{
-					auto pos = self->lemmatizer.get_pos(l.lemma_id);
-					return make_tuple(self->lemmatizer.get_lemma(l.lemma_id), self->lemmatizer.to_perseus_tag(l.feature, pos));
+					auto pos = self->lemmatizer->get_pos(l.lemma_id);
+					return make_tuple(self->lemmatizer->get_lemma(l.lemma_id), self->lemmatizer->to_perseus_tag(l.feature, pos));
 				}) :
 				py::buildPyValueTransform(info.lemma_cands.begin(), info.lemma_cands.end(), [&](const lamon::Lemmatizer::LemmaInfo& l)
 				{
@@ -249,7 +497,7 @@ static PyObject* LL_list_candidates(LamonObject* self, PyObject* args, PyObject*
 					py::setPyDictItem(f, "number", l.feature.number);
 					py::setPyDictItem(f, "case", l.feature.case_);
 					py::setPyDictItem(f, "degree", l.feature.degree);
-					return make_tuple(self->lemmatizer.get_lemma(l.lemma_id), f);
+					return make_tuple(self->lemmatizer->get_lemma(l.lemma_id), f);
 				})
 			);
 		});
@@ -270,11 +518,17 @@ static PyObject* LL_tag(LamonObject* self, PyObject* args, PyObject* kwargs)
 	const char* text;
 	const char* tag_style = "perseus";
 	size_t bidirection = 1, beam_size = 1;
-	static const char* kwlist[] = { "text", "tag_style", "beam_size", "bidirection", nullptr };
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|sip", (char**)kwlist, 
-		&text, &tag_style, &beam_size, &bidirection)) return nullptr;
+	Py_ssize_t search_beam_size = 10;
+	float beam_margin = INFINITY, candidate_margin = INFINITY;
+	int marginals = 0;
+	static const char* kwlist[] = { "text", "tag_style", "beam_size", "bidirection", "search_beam_size", "beam_margin", "candidate_margin", 
+		"marginals", nullptr };
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|sipnffp", (char**)kwlist, 
+		&text, &tag_style, &beam_size, &bidirection, &search_beam_size, &beam_margin, &candidate_margin, &marginals)) return nullptr;
 	try
 	{
+		if (search_beam_size < 1) throw runtime_error{ "`search_beam_size` must be positive" };
+		if (!(beam_margin >= 0) || !(candidate_margin >= 0)) throw runtime_error{ "`beam_margin` and `candidate_margin` must be non-negative" };
 		if (tag_style != string{ "perseus" } && tag_style != string{ "vivens" } && tag_style != string{ "raw" })
 		{
 			throw runtime_error{
@@ -282,9 +536,21 @@ static PyObject* LL_tag(LamonObject* self, PyObject* args, PyObject* kwargs)
 			};
 		}
 
-		auto ret = self->lemmatizer.tag(*self->rnn_model, text, max(beam_size, (size_t)10), !!bidirection);
-		if(ret.size() > beam_size) ret.erase(ret.begin() + beam_size, ret.end());
-		return build_tagged_result(ret, self->lemmatizer, text, tag_style);
+		lamon::Lemmatizer::Marginals m;
+		vector<lamon::Lemmatizer::Candidate> ret;
+		{
+			const string utf8 = text;
+			py::ReleaseGIL nogil;
+			LamonObject::WorkspaceLease lease{ self, self->acquire_workspace() };
+			ret = self->tag(utf8, beam_size, search_beam_size, !!bidirection, lamon::BeamPruning{ beam_margin, candidate_margin }, lease.ws,
+				marginals ? &m : nullptr);
+		}
+		if (!marginals) return build_tagged_result(ret, *self->lemmatizer, text, tag_style);
+		// the results are empty only if the text has no token, and so are the marginals then
+		const vector<lamon::Lemmatizer::Token> no_tokens;
+		py::UniqueObj result{ build_tagged_result(ret, *self->lemmatizer, text, tag_style) };
+		py::UniqueObj marg{ build_marginals(m, ret.empty() ? no_tokens : ret[0].second, *self->lemmatizer, text, tag_style) };
+		return Py_BuildValue("(OO)", result.get(), marg.get());
 	}
 	catch (const bad_exception&)
 	{
@@ -297,23 +563,139 @@ static PyObject* LL_tag(LamonObject* self, PyObject* args, PyObject* kwargs)
 	}
 }
 
+/*
+* receives the results of `tag_multi(ordered=False)` from the workers in the order they finish.
+* It is shared with the tasks, which may outlive the iterator when it is released early.
+*/
+struct TagCompletionQueue
+{
+	struct Entry
+	{
+		size_t index;
+		string text;
+		vector<lamon::Lemmatizer::Candidate> result;
+		exception_ptr error;
+	};
+
+	mutex mtx;
+	condition_variable cv;
+	deque<Entry> done;
+
+	void push(Entry&& e)
+	{
+		{
+			lock_guard<mutex> lock{ mtx };
+			done.emplace_back(move(e));
+		}
+		cv.notify_one();
+	}
+
+	// blocks until any result arrives
+	Entry pop()
+	{
+		unique_lock<mutex> lock{ mtx };
+		cv.wait(lock, [&]() { return !done.empty(); });
+		Entry e = move(done.front());
+		done.pop_front();
+		return e;
+	}
+};
+
+/*
+* iterates the results of `tag_multi` in the order of `texts`, or as `(index, result)` in the order they finish if not `ordered`.
+* `texts` is read as the results are consumed, keeping at most `max_in_flight` texts submitted to the workers (0, for `None`, reads all of them at once),
+* and each result is freed as soon as it is returned.
+*/
 struct LamonTagMultiResultObject
 {
 	PyObject_HEAD;
 	LamonObject* lamon;
-	vector<future<pair<string, vector<lamon::Lemmatizer::Candidate>>>> futures;
-	size_t position;
+	// the iterator over `texts`, or null after it is exhausted
+	PyObject* texts;
+	deque<future<pair<string, vector<lamon::Lemmatizer::Candidate>>>> futures;
+	shared_ptr<TagCompletionQueue> completed;
+	// the number of texts read and of those whose results are not returned yet
+	size_t num_submitted, num_pending;
+	size_t max_in_flight;
+	size_t beam_size, search_beam_size;
+	bool bidirection, ordered;
+	lamon::BeamPruning pruning;
 	string tag_style;
 
 	static int init(LamonTagMultiResultObject* self, PyObject* args, PyObject* kwargs)
 	{
 		self->lamon = nullptr;
-		new (&self->futures) vector<future<pair<string, vector<lamon::Lemmatizer::Candidate>>>>{};
+		self->texts = nullptr;
+		new (&self->futures) deque<future<pair<string, vector<lamon::Lemmatizer::Candidate>>>>{};
+		new (&self->completed) shared_ptr<TagCompletionQueue>{};
+		self->num_submitted = 0;
+		self->num_pending = 0;
+		self->max_in_flight = 0;
+		self->beam_size = 1;
+		self->search_beam_size = 1;
+		self->bidirection = true;
+		self->ordered = true;
+		new (&self->pruning) lamon::BeamPruning{};
 		new (&self->tag_style) string{};
-		self->position = 0;
 		return 0;
 	}
 
+	// submits texts to the workers until `max_in_flight` of them are pending. Throws `bad_exception` if the iterator raises.
+	void fill()
+	{
+		if (!ordered && !completed) completed = make_shared<TagCompletionQueue>();
+		while (texts && (!max_in_flight || num_pending < max_in_flight))
+		{
+			py::UniqueObj item = PyIter_Next(texts);
+			if (!item)
+			{
+				Py_CLEAR(texts);
+				if (PyErr_Occurred()) throw bad_exception{};
+				break;
+			}
+			const char* utf8 = PyUnicode_AsUTF8(item);
+			if (!utf8)
+			{
+				Py_CLEAR(texts);
+				throw runtime_error{ "`texts` must be iterable of str." };
+			}
+			LamonObject* self = lamon;
+			size_t beam_size = this->beam_size, search_beam_size = this->search_beam_size;
+			bool bidirection = this->bidirection;
+			lamon::BeamPruning pruning = this->pruning;
+			if (ordered)
+			{
+				futures.emplace_back(lamon->pool->enqueue([=](size_t thread_id, const string& text)
+				{
+					auto ret = self->tag(text, beam_size, search_beam_size, bidirection, pruning, self->worker_workspaces[thread_id]);
+					return make_pair(text, move(ret));
+				}, utf8));
+			}
+			else
+			{
+				size_t index = num_submitted;
+				shared_ptr<TagCompletionQueue> completed = this->completed;
+				lamon->pool->enqueue([=](size_t thread_id, const string& text)
+				{
+					TagCompletionQueue::Entry e;
+					e.index = index;
+					e.text = text;
+					try
+					{
+						e.result = self->tag(text, beam_size, search_beam_size, bidirection, pruning, self->worker_workspaces[thread_id]);
+					}
+					catch (...)
+					{
+						e.error = current_exception();
+					}
+					completed->push(move(e));
+				}, utf8);
+			}
+			++num_submitted;
+			++num_pending;
+		}
+	}
+
 	static PyObject* iter(LamonTagMultiResultObject* self)
 	{
 		Py_INCREF(self);
@@ -322,17 +704,48 @@ struct LamonTagMultiResultObject
 
 	static PyObject* iter_next(LamonTagMultiResultObject* self)
 	{
-		if (self->position >= self->futures.size()) return nullptr;
-		auto p = self->futures[self->position++].get();
-		auto& text = p.first;
-		auto& result = p.second;
-		return build_tagged_result(result, self->lamon->lemmatizer, text, self->tag_style);
+		try
+		{
+			self->fill();
+			if (!self->num_pending) return nullptr;
+			--self->num_pending;
+			if (self->ordered)
+			{
+				auto f = move(self->futures.front());
+				self->futures.pop_front();
+				{
+					py::ReleaseGIL nogil;
+					f.wait();
+				}
+				auto p = f.get();
+				return build_tagged_result(p.second, *self->lamon->lemmatizer, p.first, self->tag_style);
+			}
+
+			TagCompletionQueue::Entry e;
+			{
+				py::ReleaseGIL nogil;
+				e = self->completed->pop();
+			}
+			if (e.error) rethrow_exception(e.error);
+			return Py_BuildValue("(nN)", (Py_ssize_t)e.index, build_tagged_result(e.result, *self->lamon->lemmatizer, e.text, self->tag_style));
+		}
+		catch (const bad_exception&)
+		{
+			return nullptr;
+		}
+		catch (const exception& e)
+		{
+			PyErr_SetString(PyExc_Exception, e.what());
+			return nullptr;
+		}
 	}
 
 	static void dealloc(LamonTagMultiResultObject* self)
 	{
+		Py_XDECREF(self->texts);
 		Py_XDECREF(self->lamon);
-		self->futures.~vector();
+		self->futures.~deque();
+		self->completed.~shared_ptr();
 		self->tag_style.~basic_string();
 		Py_TYPE(self)->tp_free((PyObject*)self);
 	}
@@ -383,17 +796,73 @@ static PyObject* LL_tag_multi(LamonObject* self, PyObject* args, PyObject* kwarg
 {
 	PyObject* texts;
 	const char* tag_style = "perseus";
-	size_t bidirection = 1, beam_size = 1, num_workers = 0;
-	static const char* kwlist[] = { "texts", "tag_style", "beam_size", "bidirection", "num_workers", nullptr };
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|sipi", (char**)kwlist,
-		&texts, &tag_style, &beam_size, &bidirection, &num_workers)) return nullptr;
-	if (!num_workers) num_workers = thread::hardware_concurrency();
+	size_t bidirection = 1, beam_size = 1, num_workers = 0, ordered = 1;
+	Py_ssize_t search_beam_size = 10, max_in_flight = 0;
+	PyObject* max_in_flight_ = Py_None;
+	float beam_margin = INFINITY, candidate_margin = INFINITY;
+	static const char* kwlist[] = { "texts", "tag_style", "beam_size", "bidirection", "num_workers", "search_beam_size", "beam_margin", "candidate_margin", "max_in_flight", "ordered", nullptr };
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|sipinffOp", (char**)kwlist,
+		&texts, &tag_style, &beam_size, &bidirection, &num_workers, &search_beam_size, &beam_margin, &candidate_margin, &max_in_flight_, &ordered)) return nullptr;
+	self->prepare_pool(num_workers);
+
+	try
+	{
+		if (tag_style != string{ "perseus" } && tag_style != string{ "vivens" } && tag_style != string{ "raw" })
+		{
+			throw runtime_error{
+				lamon::text::format("`tag_style` = '%s'. `tag_style` must be 'perseus', 'vivens' or 'raw'!", tag_style)
+			};
+		}
+		if (search_beam_size < 1) throw runtime_error{ "`search_beam_size` must be positive" };
+		if (!(beam_margin >= 0) || !(candidate_margin >= 0)) throw runtime_error{ "`beam_margin` and `candidate_margin` must be non-negative" };
+		if (max_in_flight_ != Py_None)
+		{
+			max_in_flight = PyLong_AsSsize_t(max_in_flight_);
+			if (max_in_flight == -1 && PyErr_Occurred()) throw bad_exception{};
+			if (max_in_flight < 1) throw runtime_error{ "`max_in_flight` must be positive" };
+		}
+		if(PyUnicode_Check(texts)) throw runtime_error{ "`texts` must be iterable of str." };
+		py::UniqueObj iter = PyObject_GetIter(texts);
+		if (!iter) throw runtime_error{ "`texts` must be iterable of str." };
 
-	if (!self->pool || self->pool->getNumWorkers() != num_workers)
+		py::UniqueObj ret = PyObject_CallObject((PyObject*)&LamonTagMultiResult_type, nullptr);
+		if (!ret) throw bad_exception{};
+		auto* result = (LamonTagMultiResultObject*)ret.get();
+		Py_INCREF(self);
+		result->lamon = self;
+		result->texts = iter.release();
+		result->max_in_flight = max_in_flight;
+		result->beam_size = beam_size;
+		result->search_beam_size = search_beam_size;
+		result->bidirection = !!bidirection;
+		result->ordered = !!ordered;
+		result->pruning = lamon::BeamPruning{ beam_margin, candidate_margin };
+		result->tag_style = tag_style;
+		result->fill();
+		return ret.release();
+	}
+	catch (const bad_exception&)
 	{
-		if (self->pool) delete self->pool;
-		self->pool = new ThreadPool{ num_workers };
+		return nullptr;
 	}
+	catch (const exception& e)
+	{
+		PyErr_SetString(PyExc_Exception, e.what());
+		return nullptr;
+	}
+}
+
+static PyObject* LL_tag_document(LamonObject* self, PyObject* args, PyObject* kwargs)
+{
+	const char* text_;
+	const char* tag_style = "perseus";
+	size_t bidirection = 1, beam_size = 1, num_workers = 0;
+	Py_ssize_t search_beam_size = 10;
+	float beam_margin = INFINITY, candidate_margin = INFINITY;
+	static const char* kwlist[] = { "text", "tag_style", "beam_size", "bidirection", "num_workers", "search_beam_size", "beam_margin", "candidate_margin", nullptr };
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|sipinff", (char**)kwlist,
+		&text_, &tag_style, &beam_size, &bidirection, &num_workers, &search_beam_size, &beam_margin, &candidate_margin)) return nullptr;
+	self->prepare_pool(num_workers);
 
 	try
 	{
@@ -403,30 +872,406 @@ static PyObject* LL_tag_multi(LamonObject* self, PyObject* args, PyObject* kwarg
 				lamon::text::format("`tag_style` = '%s'. `tag_style` must be 'perseus', 'vivens' or 'raw'!", tag_style)
 			};
 		}
-		if(PyUnicode_Check(texts)) throw runtime_error{ "`texts` must be iterable of str." };
+		if (search_beam_size < 1) throw runtime_error{ "`search_beam_size` must be positive" };
+		if (!(beam_margin >= 0) || !(candidate_margin >= 0)) throw runtime_error{ "`beam_margin` and `candidate_margin` must be non-negative" };
+		const lamon::BeamPruning pruning{ beam_margin, candidate_margin };
+		const string text = text_;
+
+		// each sentence is tagged separately, so that a long document is decoded on every worker in short beams
+		auto sents = lamon::Lemmatizer::split_sentences(text);
+		vector<future<vector<lamon::Lemmatizer::Candidate>>> futures;
+		futures.reserve(sents.size());
+		for (auto& s : sents)
+		{
+			futures.emplace_back(self->pool->enqueue([=](size_t thread_id, const string& sent)
+			{
+				return self->tag(sent, beam_size, search_beam_size, !!bidirection, pruning, self->worker_workspaces[thread_id]);
+			}, text.substr(s.first, s.second - s.first)));
+		}
+
+		{
+			py::ReleaseGIL nogil;
+			for (auto& f : futures) f.wait();
+		}
+
+		py::UniqueObj ret = PyList_New(sents.size());
+		size_t chrs = 0, bytes = 0;
+		for (size_t i = 0; i < sents.size(); ++i)
+		{
+			auto result = futures[i].get();
+			chrs += count_uchars(text.data() + bytes, text.data() + sents[i].first);
+			const uint32_t start = chrs;
+			chrs += count_uchars(text.data() + sents[i].first, text.data() + sents[i].second);
+			bytes = sents[i].second;
+			PyObject* tagged = build_tagged_result(result, *self->lemmatizer, text.substr(sents[i].first, sents[i].second - sents[i].first), tag_style, start);
+			PyList_SET_ITEM(ret.get(), i, Py_BuildValue("(IIN)", start, (uint32_t)chrs, tagged));
+		}
+		return ret.release();
+	}
+	catch (const bad_exception&)
+	{
+		return nullptr;
+	}
+	catch (const exception& e)
+	{
+		PyErr_SetString(PyExc_Exception, e.what());
+		return nullptr;
+	}
+}
+
+static PyObject* LL_tag_arrays(LamonObject* self, PyObject* args, PyObject* kwargs)
+{
+	PyObject* texts;
+	size_t bidirection = 1, num_workers = 0;
+	Py_ssize_t search_beam_size = 10;
+	float beam_margin = INFINITY, candidate_margin = INFINITY;
+	static const char* kwlist[] = { "texts", "bidirection", "num_workers", "search_beam_size", "beam_margin", "candidate_margin", nullptr };
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|pninff", (char**)kwlist,
+		&texts, &bidirection, &num_workers, &search_beam_size, &beam_margin, &candidate_margin)) return nullptr;
+	self->prepare_pool(num_workers);
+
+	try
+	{
+		if (search_beam_size < 1) throw runtime_error{ "`search_beam_size` must be positive" };
+		if (!(beam_margin >= 0) || !(candidate_margin >= 0)) throw runtime_error{ "`beam_margin` and `candidate_margin` must be non-negative" };
+		const lamon::BeamPruning pruning{ beam_margin, candidate_margin };
+		if (PyUnicode_Check(texts)) throw runtime_error{ "`texts` must be iterable of str." };
 		py::UniqueObj iter = PyObject_GetIter(texts);
 		if (!iter) throw runtime_error{ "`texts` must be iterable of str." };
 		py::UniqueObj item;
-		vector<future<pair<string, vector<lamon::Lemmatizer::Candidate>>>> futures;
+		vector<string> sents;
+		vector<future<vector<lamon::Lemmatizer::Candidate>>> futures;
 		while ((item = PyIter_Next(iter)))
 		{
 			const char* utf8 = PyUnicode_AsUTF8(item);
 			if (!utf8) throw runtime_error{ "`texts` must be iterable of str." };
+			sents.emplace_back(utf8);
 			futures.emplace_back(self->pool->enqueue([=](size_t thread_id, const string& text)
 			{
-				auto ret = self->lemmatizer.tag(*self->rnn_model, text, max(beam_size, (size_t)10), !!bidirection);
-				if(ret.size() > beam_size) ret.erase(ret.begin() + beam_size, ret.end());
-				return make_pair(text, move(ret));
-			}, utf8));
+				return self->tag(text, 1, search_beam_size, !!bidirection, pruning, self->worker_workspaces[thread_id]);
+			}, sents.back()));
 		}
 		if (PyErr_Occurred()) throw bad_exception{};
 
-		LamonTagMultiResultObject* ret = (LamonTagMultiResultObject*)PyObject_CallObject((PyObject*)&LamonTagMultiResult_type, nullptr);
+		{
+			py::ReleaseGIL nogil;
+			for (auto& f : futures) f.wait();
+		}
+
+		vector<int64_t> offsets;
+		vector<uint32_t> starts, ends, lemma_ids;
+		vector<uint64_t> features;
+		vector<uint8_t> pos;
+		vector<float> scores;
+		offsets.reserve(sents.size() + 1);
+		scores.reserve(sents.size());
+		offsets.emplace_back(0);
+		for (size_t i = 0; i < sents.size(); ++i)
+		{
+			auto result = futures[i].get();
+			scores.emplace_back(result.empty() ? 0 : result[0].first);
+			if (!result.empty())
+			{
+				auto& text = sents[i];
+				size_t chrs = 0, bytes = 0;
+				for (auto& t : result[0].second)
+				{
+					if (bytes <= t.start) chrs += count_uchars(text.data() + bytes, text.data() + t.start);
+					else chrs = count_uchars(text.data(), text.data() + t.start);
+					starts.emplace_back(chrs);
+					chrs += count_uchars(text.data() + t.start, text.data() + t.end);
+					ends.emplace_back(chrs);
+					bytes = t.end;
+					lemma_ids.emplace_back(t.lemma_id);
+					features.emplace_back(t.feature.u64);
+					pos.emplace_back(self->lemmatizer->get_pos(t.lemma_id));
+				}
+			}
+			offsets.emplace_back(starts.size());
+		}
+
+		py::UniqueObj ret = PyDict_New();
+		py::setPyDictItem(ret, "offsets", offsets);
+		py::setPyDictItem(ret, "start", starts);
+		py::setPyDictItem(ret, "end", ends);
+		py::setPyDictItem(ret, "lemma_id", lemma_ids);
+		py::setPyDictItem(ret, "feature", features);
+		py::setPyDictItem(ret, "pos", pos);
+		py::setPyDictItem(ret, "score", scores);
+		return ret.release();
+	}
+	catch (const bad_exception&)
+	{
+		return nullptr;
+	}
+	catch (const exception& e)
+	{
+		PyErr_SetString(PyExc_Exception, e.what());
+		return nullptr;
+	}
+}
+
+// converts `obj` into a contiguous 1-dim array of `type`, or throws `bad_exception` with the error of NumPy
+static py::UniqueObj as_id_array(PyObject* obj, int type)
+{
+	py::UniqueObj arr = PyArray_FROMANY(obj, type, 1, 1, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+	if (!arr) throw bad_exception{};
+	return arr;
+}
+
+static PyObject* LL_decode_lemmas(LamonObject* self, PyObject* args, PyObject* kwargs)
+{
+	PyObject* ids_;
+	static const char* kwlist[] = { "lemma_ids", nullptr };
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", (char**)kwlist, &ids_)) return nullptr;
+
+	try
+	{
+		py::UniqueObj ids = as_id_array(ids_, NPY_UINT32);
+		const size_t n = PyArray_SIZE((PyArrayObject*)ids.get());
+		auto* data = (const uint32_t*)PyArray_DATA((PyArrayObject*)ids.get());
+		for (size_t i = 0; i < n; ++i)
+		{
+			if (data[i] >= self->lemmatizer->get_num_lemmas()) throw out_of_range{ lamon::text::format("`lemma_id` %u is out of range", data[i]) };
+		}
+
+		// a bulk output repeats the same lemmas, so each of them is built once and shared
+		unordered_map<uint32_t, py::UniqueObj> strs;
+		py::UniqueObj ret = PyList_New(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			auto& s = strs[data[i]];
+			if (!s) s = py::buildPyValue(self->lemmatizer->get_lemma(data[i]));
+			Py_INCREF(s.get());
+			PyList_SET_ITEM(ret.get(), i, s.get());
+		}
+		return ret.release();
+	}
+	catch (const bad_exception&)
+	{
+		return nullptr;
+	}
+	catch (const exception& e)
+	{
+		PyErr_SetString(PyExc_Exception, e.what());
+		return nullptr;
+	}
+}
+
+static PyObject* LL_decode_tags(LamonObject* self, PyObject* args, PyObject* kwargs)
+{
+	PyObject* features_;
+	PyObject* pos_ = Py_None;
+	const char* tag_style_ = "perseus";
+	static const char* kwlist[] = { "features", "pos", "tag_style", nullptr };
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Os", (char**)kwlist, &features_, &pos_, &tag_style_)) return nullptr;
+
+	try
+	{
+		const string tag_style = tag_style_;
+		if (tag_style != "perseus" && tag_style != "vivens")
+		{
+			throw runtime_error{
+				lamon::text::format("`tag_style` = '%s'. `tag_style` must be 'perseus' or 'vivens'!", tag_style_)
+			};
+		}
+		if (tag_style == "perseus" && pos_ == Py_None) throw runtime_error{ "`pos` is required for 'perseus' tags" };
+
+		py::UniqueObj features = as_id_array(features_, NPY_UINT64);
+		const size_t n = PyArray_SIZE((PyArrayObject*)features.get());
+		auto* fdata = (const uint64_t*)PyArray_DATA((PyArrayObject*)features.get());
+		py::UniqueObj pos;
+		const uint8_t* pdata = nullptr;
+		if (pos_ != Py_None)
+		{
+			pos = as_id_array(pos_, NPY_UINT8);
+			if ((size_t)PyArray_SIZE((PyArrayObject*)pos.get()) != n) throw runtime_error{ "`features` and `pos` must have the same length" };
+			pdata = (const uint8_t*)PyArray_DATA((PyArrayObject*)pos.get());
+		}
+
+		map<pair<uint64_t, uint8_t>, py::UniqueObj> strs;
+		py::UniqueObj ret = PyList_New(n);
+		for (size_t i = 0; i < n; ++i)
+		{
+			const uint8_t p = tag_style == "perseus" ? pdata[i] : 0;
+			auto& s = strs[make_pair(fdata[i], p)];
+			if (!s)
+			{
+				s = py::buildPyValue(tag_style == "perseus" ? 
+					lamon::Lemmatizer::to_perseus_tag(lamon::Feature{ fdata[i] }, (char)p) :
+					lamon::Lemmatizer::to_vivens_tag(lamon::Feature{ fdata[i] }));
+			}
+			Py_INCREF(s.get());
+			PyList_SET_ITEM(ret.get(), i, s.get());
+		}
+		return ret.release();
+	}
+	catch (const bad_exception&)
+	{
+		return nullptr;
+	}
+	catch (const exception& e)
+	{
+		PyErr_SetString(PyExc_Exception, e.what());
+		return nullptr;
+	}
+}
+
+struct LamonSessionObject
+{
+	PyObject_HEAD;
+	LamonObject* lamon;
+	lamon::TagSession* session;
+	size_t beam_size;
+	// serializes `tag`, which runs without the GIL, since the session is not thread-safe
+	mutex mtx;
+
+	static int init(LamonSessionObject* self, PyObject* args, PyObject* kwargs)
+	{
+		self->lamon = nullptr;
+		self->session = nullptr;
+		self->beam_size = 1;
+		new (&self->mtx) mutex{};
+		return 0;
+	}
+
+	static void dealloc(LamonSessionObject* self)
+	{
+		if (self->session)
+		{
+			delete self->session;
+			self->session = nullptr;
+		}
+		Py_XDECREF(self->lamon);
+		self->mtx.~mutex();
+		Py_TYPE(self)->tp_free((PyObject*)self);
+	}
+};
+
+static PyObject* LS_tag(LamonSessionObject* self, PyObject* args, PyObject* kwargs)
+{
+	const char* text;
+	const char* tag_style = "perseus";
+	int marginals = 0;
+	static const char* kwlist[] = { "text", "tag_style", "marginals", nullptr };
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|sp", (char**)kwlist, &text, &tag_style, &marginals)) return nullptr;
+	try
+	{
+		if (!self->session) throw runtime_error{ "create a session by `Lamon.session()`" };
+		if (tag_style != string{ "perseus" } && tag_style != string{ "vivens" } && tag_style != string{ "raw" })
+		{
+			throw runtime_error{
+				lamon::text::format("`tag_style` = '%s'. `tag_style` must be 'perseus', 'vivens' or 'raw'!", tag_style)
+			};
+		}
+
+		lamon::Lemmatizer::Marginals m;
+		vector<lamon::Lemmatizer::Candidate> ret;
+		{
+			const string utf8 = text;
+			py::ReleaseGIL nogil;
+			lock_guard<mutex> lock{ self->mtx };
+			ret = self->session->tag(utf8, marginals ? &m : nullptr);
+		}
+		if (ret.size() > self->beam_size) ret.erase(ret.begin() + self->beam_size, ret.end());
+		if (!marginals) return build_tagged_result(ret, *self->lamon->lemmatizer, text, tag_style);
+		const vector<lamon::Lemmatizer::Token> no_tokens;
+		py::UniqueObj result{ build_tagged_result(ret, *self->lamon->lemmatizer, text, tag_style) };
+		py::UniqueObj marg{ build_marginals(m, ret.empty() ? no_tokens : ret[0].second, *self->lamon->lemmatizer, text, tag_style) };
+		return Py_BuildValue("(OO)", result.get(), marg.get());
+	}
+	catch (const bad_exception&)
+	{
+		return nullptr;
+	}
+	catch (const exception& e)
+	{
+		PyErr_SetString(PyExc_Exception, e.what());
+		return nullptr;
+	}
+}
+
+static PyObject* LamonSession_get_resumed_from(LamonSessionObject* self, void* closure)
+{
+	if (!self->session) return PyLong_FromSize_t(0);
+	lock_guard<mutex> lock{ self->mtx };
+	return PyLong_FromSize_t(self->session->get_resumed_from());
+}
+
+static PyMethodDef LamonSession_methods[] = {
+	{ "tag", (PyCFunction)LS_tag, METH_VARARGS | METH_KEYWORDS, LamonSession_tag__doc__ },
+	{ nullptr },
+};
+
+static PyGetSetDef LamonSession_getseters[] = {
+	{ (char*)"resumed_from", (getter)LamonSession_get_resumed_from, nullptr, LamonSession_resumed_from__doc__, nullptr },
+	{ nullptr },
+};
+
+PyTypeObject LamonSession_type = {
+	PyVarObject_HEAD_INIT(nullptr, 0)
+	"LamonSession",             /* tp_name */
+	sizeof(LamonSessionObject), /* tp_basicsize */
+	0,                         /* tp_itemsize */
+	(destructor)LamonSessionObject::dealloc, /* tp_dealloc */
+	0,                         /* tp_print */
+	0,                         /* tp_getattr */
+	0,                         /* tp_setattr */
+	0,                         /* tp_reserved */
+	0, /* tp_repr */
+	0,                         /* tp_as_number */
+	0,                         /* tp_as_sequence */
+	0,                         /* tp_as_mapping */
+	0,                         /* tp_hash  */
+	0,                         /* tp_call */
+	0,                         /* tp_str */
+	0,                         /* tp_getattro */
+	0,                         /* tp_setattro */
+	0,                         /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT,   /* tp_flags */
+	LamonSession__doc__,           /* tp_doc */
+	0,                         /* tp_traverse */
+	0,                         /* tp_clear */
+	0,                         /* tp_richcompare */
+	0,                         /* tp_weaklistoffset */
+	0,                         /* tp_iter */
+	0,                         /* tp_iternext */
+	LamonSession_methods,             /* tp_methods */
+	0,						 /* tp_members */
+	LamonSession_getseters,        /* tp_getset */
+	0,                         /* tp_base */
+	0,                         /* tp_dict */
+	0,                         /* tp_descr_get */
+	0,                         /* tp_descr_set */
+	0,                         /* tp_dictoffset */
+	(initproc)LamonSessionObject::init,      /* tp_init */
+	PyType_GenericAlloc,
+	PyType_GenericNew,
+};
+
+static PyObject* LL_session(LamonObject* self, PyObject* args, PyObject* kwargs)
+{
+	size_t bidirection = 1, beam_size = 1;
+	Py_ssize_t search_beam_size = 10;
+	float beam_margin = INFINITY, candidate_margin = INFINITY;
+	static const char* kwlist[] = { "beam_size", "bidirection", "search_beam_size", "beam_margin", "candidate_margin", nullptr };
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ipnff", (char**)kwlist,
+		&beam_size, &bidirection, &search_beam_size, &beam_margin, &candidate_margin)) return nullptr;
+	try
+	{
+		if (search_beam_size < 1) throw runtime_error{ "`search_beam_size` must be positive" };
+		if (!(beam_margin >= 0) || !(candidate_margin >= 0)) throw runtime_error{ "`beam_margin` and `candidate_margin` must be non-negative" };
+
+		py::UniqueObj ret{ PyObject_CallObject((PyObject*)&LamonSession_type, nullptr) };
+		if (!ret) throw bad_exception{};
+		LamonSessionObject* session = (LamonSessionObject*)ret.get();
+		session->session = new lamon::TagSession{ *self->lemmatizer, *self->rnn_model, max(beam_size, (size_t)search_beam_size), 
+			!!bidirection, lamon::BeamPruning{ beam_margin, candidate_margin } };
+		session->beam_size = max(beam_size, (size_t)1);
+		// the session refers to the models, which `self` keeps alive
 		Py_INCREF(self);
-		ret->lamon = self;
-		ret->futures = move(futures);
-		ret->tag_style = tag_style;
-		return (PyObject*)ret;
+		session->lamon = self;
+		return ret.release();
 	}
 	catch (const bad_exception&)
 	{
@@ -439,10 +1284,35 @@ static PyObject* LL_tag_multi(LamonObject* self, PyObject* args, PyObject* kwarg
 	}
 }
 
+static PyObject* LL_cache_info(LamonObject* self, PyObject*)
+{
+	const lamon::TagCache* c = self->tag_cache;
+	return Py_BuildValue("{s:n,s:n,s:n,s:n}",
+		"hits", (Py_ssize_t)(c ? c->get_hits() : 0),
+		"misses", (Py_ssize_t)(c ? c->get_misses() : 0),
+		"size", (Py_ssize_t)(c ? c->size() : 0),
+		"capacity", (Py_ssize_t)(c ? c->get_capacity() : 0)
+	);
+}
+
+static PyObject* LL_cache_clear(LamonObject* self, PyObject*)
+{
+	if (self->tag_cache) self->tag_cache->clear();
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
 static PyMethodDef Lamon_methods[] = {
 	{ "list_candidates", (PyCFunction)LL_list_candidates, METH_VARARGS | METH_KEYWORDS, Lamon_list_candidates__doc__ },
 	{ "tag", (PyCFunction)LL_tag, METH_VARARGS | METH_KEYWORDS, Lamon_tag__doc__ },
 	{ "tag_multi", (PyCFunction)LL_tag_multi, METH_VARARGS | METH_KEYWORDS, Lamon_tag_multi__doc__ },
+	{ "tag_document", (PyCFunction)LL_tag_document, METH_VARARGS | METH_KEYWORDS, Lamon_tag_document__doc__ },
+	{ "tag_arrays", (PyCFunction)LL_tag_arrays, METH_VARARGS | METH_KEYWORDS, Lamon_tag_arrays__doc__ },
+	{ "decode_lemmas", (PyCFunction)LL_decode_lemmas, METH_VARARGS | METH_KEYWORDS, Lamon_decode_lemmas__doc__ },
+	{ "decode_tags", (PyCFunction)LL_decode_tags, METH_VARARGS | METH_KEYWORDS, Lamon_decode_tags__doc__ },
+	{ "session", (PyCFunction)LL_session, METH_VARARGS | METH_KEYWORDS, Lamon_session__doc__ },
+	{ "cache_info", (PyCFunction)LL_cache_info, METH_NOARGS, Lamon_cache_info__doc__ },
+	{ "cache_clear", (PyCFunction)LL_cache_clear, METH_NOARGS, Lamon_cache_clear__doc__ },
 	{ nullptr },
 };
 
@@ -488,17 +1358,88 @@ PyTypeObject Lamon_type = {
 };
 
 
+static PyObject* LL_convert_tagger(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+	const char* src_path;
+	const char* dst_path;
+	const char* quantize = nullptr;
+	const char* embedding_storage = "fp32";
+	Py_ssize_t precompute_joint = 0;
+	int format_version = 2;
+	Py_ssize_t pack_panels = 0;
+	static const char* kwlist[] = { "src_path", "dst_path", "quantize", "embedding_storage", "precompute_joint", "format_version", "pack_panels", nullptr };
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ss|zsnin", (char**)kwlist,
+		&src_path, &dst_path, &quantize, &embedding_storage, &precompute_joint, &format_version, &pack_panels)) return nullptr;
+	try
+	{
+		lamon::ConvertOption option;
+		if (quantize)
+		{
+			if (quantize != string{ "int8" })
+			{
+				throw runtime_error{
+					lamon::text::format("`quantize` = '%s'. `quantize` must be None or 'int8'!", quantize)
+				};
+			}
+			option.quantize_int8 = true;
+		}
+
+		if (embedding_storage == string{ "fp16" }) option.embedding_storage = lamon::StorageType::fp16;
+		else if (embedding_storage == string{ "bf16" }) option.embedding_storage = lamon::StorageType::bf16;
+		else if (embedding_storage != string{ "fp32" })
+		{
+			throw runtime_error{
+				lamon::text::format("`embedding_storage` = '%s'. `embedding_storage` must be 'fp32', 'fp16' or 'bf16'!", embedding_storage)
+			};
+		}
+
+		if (precompute_joint < -1) throw runtime_error{ "`precompute_joint` must be -1 or non-negative" };
+		option.precompute_joint_tokens = (size_t)precompute_joint;
+		option.format_version = format_version;
+		if (pack_panels < 0) throw runtime_error{ "`pack_panels` must be non-negative" };
+		option.pack_panels = (size_t)pack_panels;
+		lamon::convert_model(src_path, dst_path, option);
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+	catch (const bad_exception&)
+	{
+		return nullptr;
+	}
+	catch (const exception& e)
+	{
+		PyErr_SetString(PyExc_Exception, e.what());
+		return nullptr;
+	}
+}
+
+static PyMethodDef module_methods[] = {
+	{ "convert_tagger", (PyCFunction)LL_convert_tagger, METH_VARARGS | METH_KEYWORDS, convert_tagger__doc__ },
+	{ nullptr },
+};
+
 PyMODINIT_FUNC MODULE_NAME()
 {
 	import_array();
 
+	const char* isa;
+	try
+	{
+		isa = lamon::kernels::isa_name(lamon::kernels::active_isa());
+	}
+	catch (const exception& e)
+	{
+		PyErr_SetString(PyExc_ImportError, e.what());
+		return nullptr;
+	}
+
 	static PyModuleDef mod =
 	{
 		PyModuleDef_HEAD_INIT,
 		"_lamonpy",
 		"",
 		-1,
-		nullptr,
+		module_methods,
 	};
 
 	gModule = PyModule_Create(&mod);
@@ -509,5 +1450,9 @@ PyMODINIT_FUNC MODULE_NAME()
 	if (PyType_Ready(&LamonTagMultiResult_type) < 0) return nullptr;
 	Py_INCREF(&LamonTagMultiResult_type);
 	PyModule_AddObject(gModule, "_LamonTagMultiResult", (PyObject*)&LamonTagMultiResult_type);
+	if (PyType_Ready(&LamonSession_type) < 0) return nullptr;
+	Py_INCREF(&LamonSession_type);
+	PyModule_AddObject(gModule, "LamonSession", (PyObject*)&LamonSession_type);
+	PyModule_AddStringConstant(gModule, "isa", isa);
 	return gModule;
 }
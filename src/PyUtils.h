@@ -28,6 +28,23 @@
 
 namespace py
 {
+	/*
+	* releases the GIL for its lifetime, so that other Python threads run during native work touching no Python object.
+	* The GIL is taken back when it goes out of scope, including by an exception.
+	*/
+	struct ReleaseGIL
+	{
+		PyThreadState* state;
+		ReleaseGIL() : state(PyEval_SaveThread()) {}
+		~ReleaseGIL()
+		{
+			PyEval_RestoreThread(state);
+		}
+
+		ReleaseGIL(const ReleaseGIL&) = delete;
+		ReleaseGIL& operator=(const ReleaseGIL&) = delete;
+	};
+
 	struct UniqueObj
 	{
 		PyObject* obj;
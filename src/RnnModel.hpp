@@ -1,7 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+
 #include "layers.hpp"
 #include "LatinFeat.h"
+#include "InputGateCache.hpp"
 
 namespace lamon
 {
@@ -10,51 +18,133 @@ namespace lamon
         LSTMCell cell;
         LayerNorm layernorm;
         Dense token_proj;
-        union { std::array<Dense, 8> feat_proj; };
-        union { 
-            Dense joint_token_feat; 
-            int64_t has_joint_layer;
-        };
+        std::array<Dense, 8> feat_proj;
+        Dense joint_token_feat;
+        bool has_joint_layer = false;
         size_t approx_size, unk_token;
+
+        // rank-r factors of `token_proj.kernel.leftCols(approx_size)`, empty if the normalizer is computed exactly
+        Eigen::MatrixXf norm_basis, norm_proj;
+
+        // the embedding half of the joint layer for the tokens `[0, joint_token_part.cols())`
+        ConstMatrix<float> joint_token_part{ nullptr, 0, 0 };
+        utils::AlignedArray<float> owned_joint_token_part;
+
+        /*
+        * approximates the first `approx_size` columns K of the token projection by their best rank-`rank` factorization
+        * `norm_basis * norm_proj`. `norm_basis` holds the top left singular vectors of K, which are 
+        * the eigenvectors of the small `hidden x hidden` matrix K * K^T.
+        */
+        void factorize_normalizer(size_t rank)
+        {
+            const Eigen::MatrixXf k = token_proj.columns(0, approx_size);
+            // a factorization this large would not be any cheaper than the exact product
+            if (rank * (k.rows() + k.cols()) >= (size_t)(k.rows() * k.cols())) return;
+
+            const Eigen::MatrixXd kd = k.cast<double>();
+            Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eig{ kd * kd.transpose() };
+            // eigenvalues are sorted in increasing order
+            norm_basis = eig.eigenvectors().rightCols(rank).cast<float>();
+            norm_proj.noalias() = norm_basis.transpose() * k;
+        }
+
     public:
         using DecOutput = std::pair<size_t, Feature>;
 
         struct State
         {
-            Eigen::VectorXf input_h, c_state;
+            Eigen::VectorXf h_state, c_state;
 
             State() = default;
 
-            State(size_t input_size, size_t hidden_size) :
-                input_h{ Eigen::VectorXf::Zero(input_size + hidden_size) },
+            State(size_t hidden_size) :
+                h_state{ Eigen::VectorXf::Zero(hidden_size) },
                 c_state{ Eigen::VectorXf::Zero(hidden_size) }
             {
             }
+        };
+
+        /*
+        * per-step storage of feature log-probabilities. 
+        * The logits of the `k`-th token in `tokens` occupy columns `[k * 8, k * 8 + 8)` of a `classes x (8 * tokens.size())` matrix.
+        */
+        struct FeatureBuffer
+        {
+            // `missing` collects the tokens `Output::prepare` has to compute
+            std::vector<size_t> tokens, columns, missing;
+            std::vector<float> logits, inputs, projected, intermediate;
+            Eigen::VectorXf hidden_part;
 
-            Eigen::Block<Eigen::VectorXf, -1, 1, false> input_view()
+            void clear()
             {
-                return input_h.topRows(input_h.rows() - c_state.rows());
+                tokens.clear();
             }
         };
 
+        // scratch buffers of `apply`. The returned `Output` refers to them, so it is valid until the next `apply` on the same workspace.
+        struct Workspace
+        {
+            Eigen::VectorXf hidden, gates, projected;
+            Eigen::ArrayXf token_logits;
+            FeatureBuffer features;
+            QuantizeBuffer quantized;
+        };
+
         class Output
         {
             const RnnCell& rnn;
             const EmbeddingLookup& embs;
             const Eigen::VectorXf& hidden;
-            mutable std::unordered_map<size_t, Eigen::ArrayXXf> feat_logits_by_token;
+            FeatureBuffer& buf;
+            QuantizeBuffer& qbuf;
             float sum = 0;
 
+            // returns the index of `token` in `buf`, computing its feature logits if they have not been prepared
+            size_t find_feature_logits(size_t token) const
+            {
+                // without the joint layer, feature logits don't depend on the token and are computed once per step
+                if (!rnn.has_joint_layer) token = 0;
+                auto it = std::find(buf.tokens.begin(), buf.tokens.end(), token);
+                if (it != buf.tokens.end()) return it - buf.tokens.begin();
+                rnn.compute_feature_logits(buf, qbuf, hidden, embs, &token, &token + 1);
+                return buf.tokens.size() - 1;
+            }
+
         public:
             Output(const RnnCell& _rnn, const EmbeddingLookup& _embs,
-                const Eigen::VectorXf& _hidden, 
+                const Eigen::VectorXf& _hidden, Workspace& ws,
                 float _sum = 0)
                 : rnn{ _rnn }, embs{ _embs },
-                hidden{ _hidden },
+                hidden{ _hidden }, buf{ ws.features }, qbuf{ ws.quantized },
                 sum{ _sum }
             {
             }
 
+            /*
+            * computes the feature logits of all tokens in `[first, last)` with one matrix product per layer,
+            * instead of one matrix-vector product per token on the first access of `operator[]`.
+            */
+            template<typename _TokenIt>
+            void prepare(_TokenIt first, _TokenIt last) const
+            {
+                if (!rnn.has_joint_layer)
+                {
+                    find_feature_logits(0);
+                    return;
+                }
+
+                auto& missing = buf.missing;
+                missing.clear();
+                for (; first != last; ++first)
+                {
+                    const size_t token = *first;
+                    if (std::find(buf.tokens.begin(), buf.tokens.end(), token) != buf.tokens.end()) continue;
+                    if (std::find(missing.begin(), missing.end(), token) != missing.end()) continue;
+                    missing.emplace_back(token);
+                }
+                if (!missing.empty()) rnn.compute_feature_logits(buf, qbuf, hidden, embs, missing.begin(), missing.end());
+            }
+
             float token_logits(size_t idx) const
             {
                 if (idx >= rnn.token_proj.bias.size()) idx = rnn.unk_token;
@@ -65,49 +155,130 @@ namespace lamon
             float operator[](DecOutput dec) const
             {
                 float ret = token_logits(dec.first);
-                std::unordered_map<size_t, Eigen::ArrayXXf>::iterator it;
-                if (rnn.has_joint_layer)
+                const size_t classes = rnn.feat_proj[0].output_size(), num_feats = rnn.feat_proj.size();
+                // the lookup may grow `buf.logits`, so its data pointer is taken afterwards
+                const size_t k = find_feature_logits(dec.first);
+                const float* logits = buf.logits.data() + k * classes * num_feats;
+                for (size_t i = 0; i < num_feats; ++i)
                 {
-                    it = feat_logits_by_token.find(dec.first);
-                    if (it == feat_logits_by_token.end())
-                    {
-                        Eigen::VectorXf intermediate = rnn.joint_token_feat.apply_concated(hidden, embs[dec.first]);
-                        intermediate = intermediate.array().tanh();
+                    ret += logits[i * classes + dec.second[i]];
+                }
+                return ret;
+            }
+
+            /*
+            * scores `token` with each of the 3 x 2 x 6 combinations of gender, number and case, all other features being 0.
+            * `dest[(gender - 1) * 12 + (number - 1) * 6 + case - 1]` receives the same value as `operator[]` of that combination,
+            * but the token logit and the fixed features are summed once for the whole grid.
+            */
+            void score_declensions(size_t token, float* dest) const
+            {
+                const size_t classes = rnn.feat_proj[0].output_size(), num_feats = rnn.feat_proj.size();
+                const size_t gender = 4, number = 5, case_ = 6;
+                float prefix = token_logits(token);
+                const size_t k = find_feature_logits(token);
+                const float* logits = buf.logits.data() + k * classes * num_feats;
+
+                // the features are added in the same order as in `operator[]`, so the scores are bitwise equal
+                for (size_t i = 0; i < gender; ++i) prefix += logits[i * classes];
 
-                        Eigen::ArrayXXf feat_logits(rnn.feat_proj[0].output_size(), rnn.feat_proj.size());
-                        for (size_t i = 0; i < rnn.feat_proj.size(); ++i)
+                const float* g = logits + gender * classes + 1, *n = logits + number * classes + 1, *c = logits + case_ * classes + 1;
+                for (size_t gi = 0; gi < 3; ++gi)
+                {
+                    for (size_t ni = 0; ni < 2; ++ni)
+                    {
+                        const float gn = prefix + g[gi] + n[ni];
+                        float* d = dest + gi * 12 + ni * 6;
+                        for (size_t ci = 0; ci < 6; ++ci) d[ci] = gn + c[ci];
+                        for (size_t i = case_ + 1; i < num_feats; ++i)
                         {
-                            feat_logits.col(i) = rnn.feat_proj[i](intermediate).array();
-                            feat_logits.col(i) = logsoftmax(feat_logits.col(i));
+                            for (size_t ci = 0; ci < 6; ++ci) d[ci] += logits[i * classes];
                         }
-                        it = feat_logits_by_token.emplace(dec.first, std::move(feat_logits)).first;
                     }
                 }
-                else
+            }
+        };
+
+    private:
+        /*
+        * appends the feature log-probabilities of `tokens` to `buf`.
+        * With the joint layer, the embeddings of all tokens are gathered into one matrix,
+        * so that the joint layer and each feature projection run as a single matrix product.
+        */
+        template<typename _TokenIt>
+        void compute_feature_logits(FeatureBuffer& buf, QuantizeBuffer& qbuf, const Eigen::VectorXf& hidden, const EmbeddingLookup& embs,
+            _TokenIt first, _TokenIt last) const
+        {
+            const size_t classes = feat_proj[0].output_size(), num_feats = feat_proj.size();
+            const size_t begin = buf.tokens.size(), n = has_joint_layer ? std::distance(first, last) : 1;
+            if (has_joint_layer) buf.tokens.insert(buf.tokens.end(), first, last);
+            else buf.tokens.emplace_back(0);
+            buf.logits.resize(buf.tokens.size() * classes * num_feats);
+            Eigen::Map<Eigen::MatrixXf> logits{ buf.logits.data() + begin * classes * num_feats, (Eigen::Index)classes, (Eigen::Index)(n * num_feats) };
+
+            if (has_joint_layer)
+            {
+                const size_t emb_size = embs.get_embedding_size(), inter_size = joint_token_feat.output_size();
+                buf.inputs.resize(emb_size * n);
+                buf.intermediate.resize(inter_size * n);
+                Eigen::Map<Eigen::MatrixXf> inputs{ buf.inputs.data(), (Eigen::Index)emb_size, (Eigen::Index)n };
+                Eigen::Map<Eigen::MatrixXf> intermediate{ buf.intermediate.data(), (Eigen::Index)inter_size, (Eigen::Index)n };
+
+                // the embedding half is taken from `joint_token_part` if precomputed, otherwise the embeddings are gathered
+                buf.columns.clear();
+                for (size_t k = 0; k < n; ++k)
                 {
-                    it = feat_logits_by_token.find(-1);
-                    if (it == feat_logits_by_token.end())
+                    const size_t token = buf.tokens[begin + k];
+                    if (token < (size_t)joint_token_part.cols())
                     {
-                        Eigen::ArrayXXf feat_logits(rnn.feat_proj[0].output_size(), rnn.feat_proj.size());
-                        for (size_t i = 0; i < rnn.feat_proj.size(); ++i)
-                        {
-                            feat_logits.col(i) = rnn.feat_proj[i](hidden).array();
-                            feat_logits.col(i) = logsoftmax(feat_logits.col(i));
-                        }
-                        it = feat_logits_by_token.emplace(dec.first, std::move(feat_logits)).first;
+                        intermediate.col(k) = joint_token_part.col(token);
+                    }
+                    else
+                    {
+                        embs.copy_to(inputs.col(buf.columns.size()), token);
+                        buf.columns.emplace_back(k);
                     }
                 }
 
-                for (size_t i = 0; i < it->second.cols(); ++i)
+                if (!buf.columns.empty())
                 {
-                    ret += it->second(dec.second[i], i);
+                    const size_t m = buf.columns.size();
+                    buf.projected.resize(inter_size * m);
+                    Eigen::Map<Eigen::MatrixXf> projected{ buf.projected.data(), (Eigen::Index)inter_size, (Eigen::Index)m };
+                    joint_token_feat.rows_product(projected, inputs.leftCols(m), hidden.size(), qbuf);
+                    for (size_t i = 0; i < m; ++i) intermediate.col(buf.columns[i]) = projected.col(i);
+                }
+
+                // the hidden half of the joint layer is shared by all tokens
+                auto& hidden_part = buf.hidden_part;
+                hidden_part.resize(inter_size);
+                joint_token_feat.rows_product(hidden_part, hidden, 0, qbuf);
+                hidden_part += joint_token_feat.bias;
+                intermediate = (intermediate.colwise() + hidden_part).array().tanh().matrix();
+
+                for (size_t i = 0; i < num_feats; ++i)
+                {
+                    // column `k * num_feats + i` receives feature `i` of token `k`
+                    Eigen::Map<Eigen::MatrixXf, 0, Eigen::OuterStride<>> dest{ logits.data() + i * classes, 
+                        (Eigen::Index)classes, (Eigen::Index)n, Eigen::OuterStride<>{ (Eigen::Index)(classes * num_feats) } };
+                    feat_proj[i].apply_columns(dest, intermediate, qbuf);
                 }
-                return ret;
             }
-        };
+            else
+            {
+                for (size_t i = 0; i < num_feats; ++i) feat_proj[i].apply(logits.col(i), hidden, qbuf);
+            }
 
+            for (Eigen::Index c = 0; c < logits.cols(); ++c)
+            {
+                auto col = logits.col(c);
+                col.array() -= kernels::logsumexp(col.data(), col.size());
+            }
+        }
+
+    public:
         RnnCell(const utils::ObjectCollection& objs, const std::string& key,
-            size_t _approx_size = 2048, size_t _unk_token = 1
+            size_t _approx_size = 2048, size_t _unk_token = 1, size_t normalizer_rank = 0
         ) :
             cell{ objs, key + "/layer_0/rnn/lstm_cell" },
             layernorm{ objs, key + "/LayerNorm" },
@@ -117,199 +288,688 @@ namespace lamon
         {
             for (size_t i = 0; i < feat_proj.size(); ++i)
             {
-                new (&feat_proj[i]) Dense{ objs, key + "/output_feature_" + std::to_string(i) + "_proj" };
+                feat_proj[i] = Dense{ objs, key + "/output_feature_" + std::to_string(i) + "_proj" };
             }
 
             try
             {
-                new (&joint_token_feat) Dense{ objs, key + "/intermediate_feature_proj" };
+                joint_token_feat = Dense{ objs, key + "/intermediate_feature_proj" };
+                has_joint_layer = true;
             }
             catch (const exc::KeyNotFound&)
             {
-                has_joint_layer = 0;
+                has_joint_layer = false;
             }
-        }
 
-        ~RnnCell()
-        {
-            for (size_t i = 0; i < feat_proj.size(); ++i)
+            if (normalizer_rank) factorize_normalizer(normalizer_rank);
+
+            const std::string part_key = key + "/intermediate_feature_proj/token_part:0";
+            if (has_joint_layer && objs.count(part_key))
             {
-                if(*(int64_t*)&feat_proj[i]) feat_proj[i].~Dense();
+                new (&joint_token_part) ConstMatrix<float>{ objs[part_key].to_matrix<float>() };
+                if ((size_t)joint_token_part.rows() != joint_token_feat.output_size()) throw exc::ShapeMismatch{ "wrong shape of " + part_key };
             }
-            if (has_joint_layer)
+        }
+
+        /*
+        * computes `dest.col(t) = joint.kernel.bottomRows(emb_size)^T * embs.col(t)` for the tokens `[0, dest.cols())`,
+        * i.e. the half of the joint token-feature layer that depends only on the candidate token.
+        */
+        template<typename _DestTy>
+        static void compute_joint_token_part(_DestTy&& dest, const Dense& joint, const EmbeddingLookup& embs)
+        {
+            static const size_t chunk = 256;
+            const size_t emb_size = embs.get_embedding_size(), hidden_size = joint.input_size() - emb_size;
+            Eigen::MatrixXf inputs(emb_size, chunk);
+            QuantizeBuffer qbuf;
+            for (size_t begin = 0; begin < (size_t)dest.cols(); begin += chunk)
             {
-                joint_token_feat.~Dense();
-                has_joint_layer = 0;
+                const size_t n = std::min(chunk, (size_t)dest.cols() - begin);
+                for (size_t k = 0; k < n; ++k) embs.copy_to(inputs.col(k), begin + k);
+                joint.rows_product(dest.middleCols(begin, n), inputs.leftCols(n), hidden_size, qbuf);
             }
         }
 
+        /*
+        * precomputes the embedding half of the joint layer for the `size` most frequent tokens,
+        * unless the model file already provides it (see `ConvertOption::precompute_joint_tokens`).
+        */
+        void precompute_joint_tokens(const EmbeddingLookup& embs, size_t size)
+        {
+            if (!has_joint_layer || joint_token_part.cols()) return;
+            size = std::min(size, embs.get_vocab_size());
+            const size_t inter_size = joint_token_feat.output_size();
+            owned_joint_token_part.resize(inter_size * size);
+            Eigen::Map<Eigen::MatrixXf> part{ owned_joint_token_part.data(), (Eigen::Index)inter_size, (Eigen::Index)size };
+            compute_joint_token_part(part, joint_token_feat, embs);
+            new (&joint_token_part) ConstMatrix<float>{ owned_joint_token_part.data(), (Eigen::Index)inter_size, (Eigen::Index)size };
+        }
+
+        /*
+        * repacks the kernels of the LSTM, the joint layer and the `approx_size` columns of the token projection
+        * used for the normalizer into panels (see `Dense::pack_panels`).
+        * The feature projections are narrower than a panel and keep their column-major kernels.
+        */
+        void pack_panels()
+        {
+            cell.pack_panels();
+            if (has_joint_layer) joint_token_feat.pack_panels();
+            if (!norm_basis.size()) token_proj.pack_panels(approx_size);
+        }
+
+        void write_panels(utils::ObjectWriter& writer, const std::string& key) const
+        {
+            cell.write_panels(writer, key + "/layer_0/rnn/lstm_cell");
+            if (has_joint_layer) joint_token_feat.write_panels(writer, key + "/intermediate_feature_proj");
+            token_proj.write_panels(writer, key + "/output_token_proj");
+        }
+
         State get_initial_state() const
         {
-            return { cell.input_size(), cell.h_size() };
+            return State{ cell.h_size() };
         }
 
-        Output apply(State& state, const EmbeddingLookup& embs) const
+        size_t input_size() const { return cell.input_size(); }
+        size_t gate_size() const { return cell.output_size(); }
+
+        template<typename _DestTy, typename _EigenTy>
+        void input_gates(_DestTy&& dest, const _EigenTy& input, Workspace& ws) const
         {
-            thread_local Eigen::VectorXf hidden;
-            thread_local Eigen::ArrayXf token_logits;
+            cell.input_gates(dest, input, ws.quantized);
+        }
 
-            if(hidden.size() < cell.h_size()) hidden.resize(cell.h_size());
-            layernorm.apply(hidden, cell(state.input_h, state.c_state).bottomRows(cell.h_size()));
-            
-            Eigen::VectorXf t_logits = token_proj.partial(hidden, 0, approx_size);
-            float t_max = t_logits.maxCoeff();
-            float t_normalizer = std::log((t_logits.array() - t_max).exp().sum()) + t_max;
+        /*
+        * a step from the initial state. The first input of every sequence is the same, so is its step,
+        * which is computed once by `initial_step` and replayed by `apply_initial`.
+        */
+        struct InitialStep
+        {
+            // the state after the step
+            State state;
+            Eigen::VectorXf hidden;
+            float normalizer = 0;
+        };
 
-            Output ret{ *this, embs,  hidden, t_normalizer };
+        InitialStep initial_step(const float* x_gates, Workspace& ws) const
+        {
+            InitialStep ret;
+            ret.state = get_initial_state();
+            ret.normalizer = advance(ret.state, x_gates, ws);
+            ret.hidden = ws.hidden;
             return ret;
         }
+
+        // the same as `apply` from the initial state on the input of `step`, without computing anything but the outputs
+        Output apply_initial(const InitialStep& step, State& state, const EmbeddingLookup& embs, Workspace& ws) const
+        {
+            state.h_state = step.state.h_state;
+            state.c_state = step.state.c_state;
+            ws.features.clear();
+            return Output{ *this, embs, step.hidden, ws, step.normalizer };
+        }
+
+        // advances `state` by one step whose input is given as its precomputed `input_gates`
+        Output apply(State& state, const float* x_gates, const EmbeddingLookup& embs, Workspace& ws) const
+        {
+            const float t_normalizer = advance(state, x_gates, ws);
+            ws.features.clear();
+            Output ret{ *this, embs, ws.hidden, ws, t_normalizer };
+            return ret;
+        }
+
+    private:
+        // advances `state` by one step into `ws.hidden` and returns the log-normalizer of its token logits
+        float advance(State& state, const float* x_gates, Workspace& ws) const
+        {
+            auto& hidden = ws.hidden;
+            hidden.resize(cell.h_size());
+            layernorm.apply(hidden, cell.step(x_gates, state.c_state, state.h_state, ws.gates, ws.quantized));
+            
+            if ((size_t)ws.token_logits.size() < approx_size) ws.token_logits.resize(approx_size);
+            auto t_logits = ws.token_logits.head(approx_size);
+            if (norm_basis.size())
+            {
+                auto& projected = ws.projected;
+                projected.resize(norm_basis.cols());
+                projected.noalias() = norm_basis.transpose() * hidden;
+                t_logits.matrix().noalias() = norm_proj.transpose() * projected;
+                t_logits += token_proj.bias.head(approx_size).array();
+            }
+            else
+            {
+                token_proj.partial(t_logits.matrix(), hidden, 0, approx_size, ws.quantized);
+            }
+            return kernels::logsumexp(t_logits.data(), approx_size);
+        }
+    };
+
+    struct ModelOption
+    {
+        // the number of most frequent tokens over which the softmax normalizer is computed exactly
+        size_t approx_size = 2048;
+
+        // the maximum number of (token, feature) outputs whose input gates are cached per direction, 0 disables it
+        size_t input_cache_size = 4096;
+
+        /*
+        * if nonzero, the softmax normalizer over the `approx_size` tokens is computed 
+        * from a rank-`normalizer_rank` factorization of their projection, which is faster but approximate
+        */
+        size_t normalizer_rank = 0;
+
+        // how the model file is mapped into memory
+        utils::MMapOption mmap;
+
+        /*
+        * repacks the fp32 kernels into panels on loading (see `RnnCell::pack_panels`), 
+        * which speeds up decoding at the cost of a copy of the kernels. 
+        * Scores may differ in the last bits, since the products are summed in another order.
+        */
+        bool pack_weights = false;
+
+        ModelOption(size_t _approx_size = 2048, size_t _input_cache_size = 4096, size_t _normalizer_rank = 0,
+            const utils::MMapOption& _mmap = {}, bool _pack_weights = false)
+            : approx_size{ _approx_size }, input_cache_size{ _input_cache_size }, normalizer_rank{ _normalizer_rank },
+            mmap{ _mmap }, pack_weights{ _pack_weights }
+        {
+        }
+    };
+
+    /*
+    * adaptive pruning of the beam in `LatinRnnModel::decode`, on top of its fixed `beam_size`.
+    * Margins are in nats, and the default infinite ones disable pruning.
+    */
+    struct BeamPruning
+    {
+        // paths scoring more than `path_margin` below the best path of the same step are dropped
+        float path_margin = INFINITY;
+
+        // candidates scoring more than `candidate_margin` below the best candidate of the same path and step are not expanded
+        float candidate_margin = INFINITY;
+
+        BeamPruning(float _path_margin = INFINITY, float _candidate_margin = INFINITY)
+            : path_margin{ _path_margin }, candidate_margin{ _candidate_margin }
+        {
+        }
     };
 
     class LatinRnnModel
     {
+    public:
+        // wall-clock milliseconds spent in each stage of loading the model
+        struct LoadTimes
+        {
+            // mapping the file, including prefaulting it if requested
+            double map = 0;
+
+            // parsing the tensor index of the file
+            double parse = 0;
+
+            // constructing the layers from the tensors
+            double layers = 0;
+
+            // precomputing the joint token parts and allocating the caches
+            double precompute = 0;
+        };
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        Clock::time_point load_start;
+        LoadTimes load_times;
         utils::MMap mmap;
         utils::ObjectCollection objs;
         EmbeddingLookup token_emb;
-        union { std::array<EmbeddingLookup, 8> feat_emb; };
+        std::array<EmbeddingLookup, 8> feat_emb;
         LayerNorm emb_layernorm;
         RnnCell cell, cell_bw;
-        RnnCell::State begin_state;
+        // the first steps of the forward cell on `bos_token` and of the backward cell on `eos_token`, shared by all sequences
+        RnnCell::InitialStep bos_step, eos_step;
         size_t unk_token = 0, bos_token = 0, eos_token = 0;
+        std::unique_ptr<InputGateCache> gate_cache, gate_cache_bw;
+
     public:
         using Candidate = std::pair<float, RnnCell::DecOutput>;
         using DecSequence = std::pair<float, std::vector<RnnCell::DecOutput>>;
 
-        LatinRnnModel(const std::string& model_path, size_t approx_size = 2048,
+        // the posterior probabilities of the outputs of each step, from the most probable
+        using Marginals = std::vector<std::vector<Candidate>>;
+
+        /*
+        * buffers of `decode`, owned by the caller so that each worker reuses one across sentences.
+        * They only grow to the longest sentence and the widest beam seen, 
+        * so in the steady state `decode` makes no heap allocation except for the sequences it returns.
+        */
+        class Workspace
+        {
+            friend class LatinRnnModel;
+
+            // a beam path extended by `output`. `parent` is the index of the extended path among those of the previous step
+            struct Node
+            {
+                float score;
+                size_t parent;
+                RnnCell::DecOutput output;
+
+                Node(float _score = 0, size_t _parent = 0, const RnnCell::DecOutput& _output = {})
+                    : score{ _score }, parent{ _parent }, output{ _output }
+                {
+                }
+
+                bool operator<(const Node& o) const
+                {
+                    return score < o.score;
+                }
+            };
+
+            RnnCell::Workspace step;
+            Eigen::VectorXf input, gates;
+            std::vector<RnnCell::State> states, next_states;
+            RnnCell::State bw_state;
+            std::vector<Candidate> cands;
+            std::vector<Node> expansions;
+
+            // the paths kept at step `t` are `lattice[lattice_begin[t], lattice_begin[t + 1])`, linked to their prefixes by `parent`
+            std::vector<Node> lattice;
+            std::vector<size_t> lattice_begin;
+
+            std::vector<RnnCell::DecOutput> sequences;
+            std::vector<std::pair<float, size_t>> order;
+
+            // the posterior mass of the complete paths through each node of `lattice`
+            std::vector<float> mass;
+
+            /*
+            * if `keep_states`, `node_states[k]` holds the state of the path ending at `lattice[k]` (before its output is fed),
+            * so that `decode_from` can resume the search at any step. It only grows, to reuse the vectors of its states.
+            */
+            bool keep_states = false;
+            std::vector<RnnCell::State> node_states;
+
+            // forward steps decoded and paths advanced in them, accumulated over all calls. They may be read by other threads while decoding.
+            std::atomic<size_t> num_steps{ 0 }, num_path_steps{ 0 };
+
+        public:
+            Workspace() = default;
+
+            Workspace(const LatinRnnModel& model, size_t beam_size)
+            {
+                reserve(model, beam_size);
+            }
+
+            // sizes the buffers for decoding with `model` at `beam_size`
+            void reserve(const LatinRnnModel& model, size_t beam_size)
+            {
+                beam_size = std::max(beam_size, (size_t)1);
+                while (states.size() < beam_size) states.emplace_back(model.cell.get_initial_state());
+                while (next_states.size() < beam_size) next_states.emplace_back(model.cell.get_initial_state());
+                if (!bw_state.h_state.size()) bw_state = model.cell_bw.get_initial_state();
+                input.resize(model.cell.input_size());
+                gates.resize(std::max(model.cell.gate_size(), model.cell_bw.gate_size()));
+            }
+
+            // keeps the states of the beam at every step from the next decoding on, which `decode_from` needs to resume it
+            void keep_beam_states(bool keep = true)
+            {
+                keep_states = keep;
+            }
+
+            size_t get_num_steps() const { return num_steps; }
+            size_t get_num_path_steps() const { return num_path_steps; }
+
+            // the average number of beam paths advanced per step, i.e. the effective beam width
+            float average_beam_width() const
+            {
+                return num_steps ? num_path_steps / (float)num_steps : 0.f;
+            }
+        };
+
+    private:
+        static double elapsed_ms(Clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>{ Clock::now() - start }.count();
+        }
+
+        // returns `fn()`, adding the time it took to `ms`
+        template<typename _Fn>
+        static auto timed(double& ms, _Fn&& fn) -> decltype(fn())
+        {
+            const auto start = Clock::now();
+            auto ret = fn();
+            ms += elapsed_ms(start);
+            return ret;
+        }
+
+        // returns the input gates of `rnn` for the step following `p`, looking them up in `cache` first
+        const float* input_gates(const RnnCell& rnn, InputGateCache* cache, const RnnCell::DecOutput& p, Workspace& ws) const
+        {
+            if (cache)
+            {
+                if (const float* found = cache->find(p.first, p.second)) return found;
+            }
+
+            auto gates = ws.gates.head(rnn.gate_size());
+            embed(ws.input, p);
+            rnn.input_gates(gates, ws.input, ws.step);
+            if (cache) cache->insert(p.first, p.second, gates.data());
+            return gates.data();
+        }
+
+        RnnCell::InitialStep initial_step(const RnnCell& rnn, size_t token) const
+        {
+            Eigen::VectorXf input(rnn.input_size()), gates(rnn.gate_size());
+            RnnCell::Workspace ws;
+            embed(input, RnnCell::DecOutput{ token, {} });
+            rnn.input_gates(gates, input, ws);
+            return rnn.initial_step(gates.data(), ws);
+        }
+
+        // scores the `length` outputs of `decoded` from the end with the backward cell
+        float backward_score(Workspace& ws, const RnnCell::DecOutput* decoded, size_t length) const
+        {
+            RnnCell::State& state = ws.bw_state;
+            float score = 0;
+            for (size_t t = 0; t < length; ++t)
+            {
+                if (t == 0)
+                {
+                    score += cell_bw.apply_initial(eos_step, state, token_emb, ws.step)[decoded[length - 1]];
+                    continue;
+                }
+                const float* x_gates = input_gates(cell_bw, gate_cache_bw.get(), decoded[length - t], ws);
+                RnnCell::Output out = cell_bw.apply(state, x_gates, token_emb, ws.step);
+                score += out[decoded[length - t - 1]];
+            }
+            return score;
+        }
+
+    public:
+        LatinRnnModel(const std::string& model_path, const ModelOption& option,
             size_t _unk_token = 1, size_t _bos_token = 2, size_t _eos_token = 3) : 
-            mmap{ model_path }, objs{ utils::ObjectCollection::read_from(mmap) },
-            token_emb{ objs["emb/token_embedding:0"] },
+            load_start{ Clock::now() },
+            mmap{ timed(load_times.map, [&]() { return utils::MMap{ model_path, option.mmap }; }) },
+            objs{ timed(load_times.parse, [&]() { return utils::ObjectCollection::read_from(mmap); }) },
+            token_emb{ objs, "emb/token_embedding" },
             emb_layernorm{ objs, "emb/LayerNorm" },
-            cell{ objs, "lm", approx_size, _unk_token },
-            cell_bw{ objs, "lm_bw", approx_size, _unk_token },
+            cell{ objs, "lm", option.approx_size, _unk_token, option.normalizer_rank },
+            cell_bw{ objs, "lm_bw", option.approx_size, _unk_token, option.normalizer_rank },
             unk_token{ _unk_token },
             bos_token{ _bos_token },
             eos_token{ _eos_token }
         {
             for (size_t i = 0; i < feat_emb.size(); ++i)
             {
-                new (&feat_emb[i]) EmbeddingLookup{ objs["emb/feat_embedding:0"].to_matrix(i) };
+                feat_emb[i] = EmbeddingLookup{ objs, "emb/feat_embedding", i };
             }
-        }
+            load_times.layers = elapsed_ms(load_start) - load_times.map - load_times.parse;
 
-        ~LatinRnnModel()
-        {
-            for (size_t i = 0; i < feat_emb.size(); ++i)
+            const auto precompute_start = Clock::now();
+            if (option.pack_weights)
             {
-                if(*(int64_t*)&feat_emb[i]) feat_emb[i].~EmbeddingLookup();
+                cell.pack_panels();
+                cell_bw.pack_panels();
             }
+            cell.precompute_joint_tokens(token_emb, option.approx_size);
+            cell_bw.precompute_joint_tokens(token_emb, option.approx_size);
+            bos_step = initial_step(cell, bos_token);
+            eos_step = initial_step(cell_bw, eos_token);
+
+            if (option.input_cache_size)
+            {
+                gate_cache.reset(new InputGateCache{ option.input_cache_size, cell.gate_size() });
+                gate_cache_bw.reset(new InputGateCache{ option.input_cache_size, cell_bw.gate_size() });
+            }
+            load_times.precompute = elapsed_ms(precompute_start);
+        }
+
+        LatinRnnModel(const std::string& model_path, size_t approx_size = 2048,
+            size_t _unk_token = 1, size_t _bos_token = 2, size_t _eos_token = 3) :
+            LatinRnnModel{ model_path, ModelOption{ approx_size }, _unk_token, _bos_token, _eos_token }
+        {
         }
 
         size_t get_unk_token() const { return unk_token; }
 
-        template<typename _Selector>
-        std::vector<DecSequence> decode(size_t length, size_t beam_size, _Selector&& selector, bool bidirection = true) const
+        const LoadTimes& get_load_times() const { return load_times; }
+
+        // writes the layer-normalized input embedding of `p` into `input`
+        template<typename _DestTy>
+        void embed(_DestTy&& input, const RnnCell::DecOutput& p) const
         {
-            struct BeamPath
+            token_emb.copy_to(input, p.first);
+            for (size_t f = 0; f < p.second.u8.size(); ++f)
             {
-                float score = 0;
-                std::vector<RnnCell::DecOutput> decoded;
-                RnnCell::State state;
+                if (p.second[f]) feat_emb[f].add_to(input, p.second[f] - 1);
+            }
+            emb_layernorm.apply_inplace(input);
+        }
 
-                BeamPath() = default;
-                BeamPath(RnnCell::State&& _state) : state{ _state }
+        /*
+        * computes the posterior marginals of each step from the complete paths of the beam, 
+        * whose probabilities are the softmax of their final scores in `ws.order`.
+        * The lattice is a tree, so one backward sweep accumulates the mass of every node from its descendants.
+        */
+        void compute_marginals(Workspace& ws, size_t length, Marginals& marginals) const
+        {
+            marginals.clear();
+            // no path survived, like the results
+            if (!length || ws.order.empty()) return;
+            marginals.resize(length);
+
+            float max_score = -INFINITY, sum = 0;
+            for (auto& o : ws.order) max_score = std::max(max_score, o.first);
+            for (auto& o : ws.order) sum += std::exp(o.first - max_score);
+
+            ws.mass.assign(ws.lattice.size(), 0.f);
+            for (auto& o : ws.order) ws.mass[ws.lattice_begin[length - 1] + o.second] = std::exp(o.first - max_score) / sum;
+            for (size_t t = length; t-- > 0; )
+            {
+                const size_t begin = ws.lattice_begin[t], end = t + 1 < length ? ws.lattice_begin[t + 1] : ws.lattice.size();
+                auto& m = marginals[t];
+                for (size_t j = begin; j < end; ++j)
                 {
+                    const float p = ws.mass[j];
+                    if (!p) continue;
+                    const Workspace::Node& n = ws.lattice[j];
+                    if (t) ws.mass[ws.lattice_begin[t - 1] + n.parent] += p;
+                    // paths with different prefixes may share the output of this step
+                    auto it = std::find_if(m.begin(), m.end(), [&](const Candidate& c) { return c.second == n.output; });
+                    if (it != m.end()) it->first += p;
+                    else m.emplace_back(p, n.output);
                 }
+                std::sort(m.begin(), m.end(), [](const Candidate& a, const Candidate& b) { return a.first > b.first; });
+            }
+        }
+
+        /*
+        * the special case of `decode` with `beam_size == 1`: takes the best candidate at each step,
+        * advancing a single state without any path bookkeeping or sorting.
+        */
+        template<typename _Selector>
+        std::vector<DecSequence> decode_greedy(Workspace& ws, size_t length, _Selector&& selector, bool bidirection = true,
+            Marginals* marginals = nullptr) const
+        {
+            ws.reserve(*this, 1);
+            RnnCell::State& state = ws.states[0];
+            ws.sequences.resize(length);
+            ws.num_steps += length;
+            ws.num_path_steps += length;
 
-                bool operator<(const BeamPath& o) const
+            float score = 0;
+            for (size_t t = 0; t < length; ++t)
+            {
+                ws.cands.clear();
+                if (t) selector(t, cell.apply(state, input_gates(cell, gate_cache.get(), ws.sequences[t - 1], ws), token_emb, ws.step), ws.cands);
+                else selector(t, cell.apply_initial(bos_step, state, token_emb, ws.step), ws.cands);
+                // like `decode`, which keeps no path then
+                if (ws.cands.empty())
                 {
-                    return score < o.score;
+                    if (marginals) marginals->clear();
+                    return {};
                 }
-            };
+                auto best = std::max_element(ws.cands.begin(), ws.cands.end(), [](const Candidate& a, const Candidate& b)
+                {
+                    return a.first < b.first;
+                });
+                score += best->first;
+                ws.sequences[t] = best->second;
+            }
 
-            std::vector<BeamPath> pathes, new_pathes;
+            if (bidirection) score += backward_score(ws, ws.sequences.data(), length);
 
-            pathes.emplace_back(cell.get_initial_state());
+            if (marginals)
+            {
+                // the only path kept has all the mass
+                marginals->clear();
+                for (size_t t = 0; t < length; ++t) marginals->emplace_back(1, Candidate{ 1.f, ws.sequences[t] });
+            }
 
-            for (size_t t = 0; t < length; ++t)
+            std::vector<DecSequence> ret;
+            ret.emplace_back(score, ws.sequences);
+            return ret;
+        }
+
+        /*
+        * finds the `beam_size` best sequences of `length` outputs. `selector(t, output, cands)` appends 
+        * the candidates of step `t` scored from `output` to `cands`.
+        * `pruning` narrows the beam further where a few paths dominate.
+        * Beam paths only share their prefixes through `ws.lattice`, so no decoded sequence is copied while searching.
+        * If `marginals` is given, it receives the posterior of the outputs of each step over the complete paths kept by the beam
+        * (see `compute_marginals`). Outputs dropped by the beam get no mass, so a wider beam gives smoother posteriors.
+        */
+        template<typename _Selector>
+        std::vector<DecSequence> decode(Workspace& ws, size_t length, size_t beam_size, _Selector&& selector, bool bidirection = true,
+            const BeamPruning& pruning = {}, Marginals* marginals = nullptr) const
+        {
+            if (beam_size <= 1 && !ws.keep_states) return decode_greedy(ws, length, std::forward<_Selector>(selector), bidirection, marginals);
+            return decode_from(ws, 0, length, beam_size, std::forward<_Selector>(selector), bidirection, pruning, marginals);
+        }
+
+        /*
+        * the same as `decode`, but keeps the steps before `begin` of the previous decoding in `ws` and searches only from `begin` on.
+        * It gives the same results as `decode` if `selector` gives the same candidates as then for the steps before `begin`
+        * and the other arguments are unchanged. `ws` must keep its beam states (see `Workspace::keep_beam_states`),
+        * and `begin` must not be past the steps it decoded. The backward scores are always computed anew.
+        */
+        template<typename _Selector>
+        std::vector<DecSequence> decode_from(Workspace& ws, size_t begin, size_t length, size_t beam_size, _Selector&& selector, 
+            bool bidirection = true, const BeamPruning& pruning = {}, Marginals* marginals = nullptr) const
+        {
+            using Node = Workspace::Node;
+            beam_size = std::max(beam_size, (size_t)1);
+            ws.reserve(*this, beam_size);
+            begin = std::min(begin, length);
+            if (begin && (!ws.keep_states || begin > ws.lattice_begin.size())) throw std::invalid_argument{ "cannot resume decoding from this step" };
+
+            size_t num_paths = 1;
+            if (begin)
+            {
+                // the paths kept at step `begin - 1` take back their states
+                const size_t first = ws.lattice_begin[begin - 1], last = begin < ws.lattice_begin.size() ? ws.lattice_begin[begin] : ws.lattice.size();
+                num_paths = last - first;
+                for (size_t i = 0; i < num_paths; ++i)
+                {
+                    ws.states[i].h_state = ws.node_states[first + i].h_state;
+                    ws.states[i].c_state = ws.node_states[first + i].c_state;
+                }
+                ws.lattice.resize(last);
+                ws.lattice_begin.resize(begin);
+            }
+            else
+            {
+                ws.lattice.clear();
+                ws.lattice_begin.clear();
+            }
+
+            for (size_t t = begin; t < length; ++t)
             {
-                for (auto& path : pathes)
+                const Node* prev = t ? &ws.lattice[ws.lattice_begin[t - 1]] : nullptr;
+                ws.num_steps += 1;
+                ws.num_path_steps += num_paths;
+                ws.expansions.clear();
+                for (size_t i = 0; i < num_paths; ++i)
                 {
-                    auto input = path.state.input_view();
-                    if (t == 0)
+                    ws.cands.clear();
+                    if (prev) selector(t, cell.apply(ws.states[i], input_gates(cell, gate_cache.get(), prev[i].output, ws), token_emb, ws.step), ws.cands);
+                    else selector(t, cell.apply_initial(bos_step, ws.states[i], token_emb, ws.step), ws.cands);
+                    const float score = prev ? prev[i].score : 0;
+                    float threshold = -INFINITY;
+                    if (pruning.candidate_margin < INFINITY)
                     {
-                        input = token_emb[bos_token];
+                        for (auto& c : ws.cands) threshold = std::max(threshold, c.first);
+                        threshold -= pruning.candidate_margin;
                     }
-                    else
+                    for (auto& c : ws.cands)
                     {
-                        auto& p = path.decoded.back();
-                        input = token_emb[p.first];
-                        for (size_t f = 0; f < p.second.u8.size(); ++f)
-                        {
-                            if(p.second[f]) input += feat_emb[f][p.second[f] - 1];
-                        }
+                        if (c.first >= threshold) ws.expansions.emplace_back(score + c.first, i, c.second);
                     }
-                    emb_layernorm.apply_inplace(input);
-                    std::vector<Candidate> cands = selector(t, cell.apply(path.state, token_emb));
-
-                    auto update_idx = new_pathes.size();
-                    // to do: lazy state copy
-                    new_pathes.emplace_back(std::move(path));
-                    new_pathes.insert(new_pathes.end(), cands.size() - 1, new_pathes.back());
+                }
 
-                    for (size_t i = 0; i < cands.size(); ++i)
+                // the kept paths are stored from the best, and take over the states of the paths they extend
+                num_paths = std::min(ws.expansions.size(), beam_size);
+                std::partial_sort(ws.expansions.begin(), ws.expansions.begin() + num_paths, ws.expansions.end(), 
+                    [](const Node& a, const Node& b) { return b < a; });
+                if (num_paths && pruning.path_margin < INFINITY)
+                {
+                    const float threshold = ws.expansions[0].score - pruning.path_margin;
+                    while (ws.expansions[num_paths - 1].score < threshold) --num_paths;
+                }
+                ws.lattice_begin.emplace_back(ws.lattice.size());
+                for (size_t j = 0; j < num_paths; ++j)
+                {
+                    const Node& e = ws.expansions[j];
+                    ws.next_states[j].h_state = ws.states[e.parent].h_state;
+                    ws.next_states[j].c_state = ws.states[e.parent].c_state;
+                    if (ws.keep_states)
                     {
-                        new_pathes[update_idx + i].score += cands[i].first;
-                        new_pathes[update_idx + i].decoded.emplace_back(cands[i].second);
+                        if (ws.node_states.size() <= ws.lattice.size()) ws.node_states.resize(ws.lattice.size() + 1);
+                        ws.node_states[ws.lattice.size()].h_state = ws.next_states[j].h_state;
+                        ws.node_states[ws.lattice.size()].c_state = ws.next_states[j].c_state;
                     }
+                    ws.lattice.emplace_back(e);
                 }
-                std::sort(new_pathes.rbegin(), new_pathes.rend());
-                if (new_pathes.size() > beam_size)
+                std::swap(ws.states, ws.next_states);
+            }
+
+            // backtracks the kept paths into `sequences`, `length` outputs per path
+            ws.sequences.resize(num_paths * length);
+            ws.order.clear();
+            for (size_t k = 0; k < num_paths; ++k)
+            {
+                size_t idx = k;
+                for (size_t t = length; t-- > 0; )
                 {
-                    new_pathes.erase(new_pathes.begin() + beam_size, new_pathes.end());
+                    const Node& n = ws.lattice[ws.lattice_begin[t] + idx];
+                    ws.sequences[k * length + t] = n.output;
+                    idx = n.parent;
                 }
-                pathes = std::move(new_pathes);
-                new_pathes.clear();
+                ws.order.emplace_back(length ? ws.lattice[ws.lattice_begin[length - 1] + k].score : 0, k);
             }
 
             if (bidirection)
             {
-                for (auto& path : pathes)
-                {
-                    RnnCell::State state = cell_bw.get_initial_state();
-                    auto input = state.input_view();
-                    float score = 0;
-                    for (size_t t = 0; t < length; ++t)
-                    {
-                        if (t == 0)
-                        {
-                            input = token_emb[eos_token];
-                        }
-                        else
-                        {
-                            auto& p = path.decoded[length - t];
-                            input = token_emb[p.first];
-                            for (size_t f = 0; f < p.second.u8.size(); ++f)
-                            {
-                                if (p.second[f]) input += feat_emb[f][p.second[f] - 1];
-                            }
-                        }
-                        emb_layernorm.apply_inplace(input);
-                        RnnCell::Output out = cell_bw.apply(state, token_emb);
-                        auto& p = path.decoded[length - t - 1];
-                        score += out[p];
-                    }
-                    path.score += score;
-                }
+                for (auto& o : ws.order) o.first += backward_score(ws, &ws.sequences[o.second * length], length);
 
-                std::sort(pathes.rbegin(), pathes.rend());
+                std::sort(ws.order.rbegin(), ws.order.rend());
             }
+            if (marginals) compute_marginals(ws, length, *marginals);
             
             std::vector<DecSequence> ret;
-            for (auto& p : pathes)
+            ret.reserve(ws.order.size());
+            for (auto& o : ws.order)
             {
-                ret.emplace_back(p.score, std::move(p.decoded));
+                auto first = ws.sequences.begin() + o.second * length;
+                ret.emplace_back(o.first, std::vector<RnnCell::DecOutput>{ first, first + length });
             }
             return ret;
         }
+
+        template<typename _Selector>
+        std::vector<DecSequence> decode(size_t length, size_t beam_size, _Selector&& selector, bool bidirection = true,
+            const BeamPruning& pruning = {}) const
+        {
+            Workspace ws{ *this, beam_size };
+            return decode(ws, length, beam_size, std::forward<_Selector>(selector), bidirection, pruning);
+        }
     };
 }
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Lemmatizer.h"
+
+namespace lamon
+{
+    /*
+    * A bounded, thread-safe LRU cache of tagging results keyed by the sentence and every option that affects them.
+    * Results are shared immutably, so a hit only copies a pointer under the lock.
+    */
+    class TagCache
+    {
+    public:
+        using Result = std::vector<Lemmatizer::Candidate>;
+
+        struct Key
+        {
+            std::string text;
+            size_t beam_size;
+            bool bidirection;
+            float beam_margin, candidate_margin;
+
+            Key(const std::string& _text = {}, size_t _beam_size = 0, bool _bidirection = true,
+                float _beam_margin = 0, float _candidate_margin = 0)
+                : text{ _text }, beam_size{ _beam_size }, bidirection{ _bidirection },
+                beam_margin{ _beam_margin }, candidate_margin{ _candidate_margin }
+            {
+            }
+
+            bool operator==(const Key& o) const
+            {
+                return text == o.text && beam_size == o.beam_size && bidirection == o.bidirection
+                    && beam_margin == o.beam_margin && candidate_margin == o.candidate_margin;
+            }
+        };
+
+    private:
+        struct KeyHash
+        {
+            size_t operator()(const Key& k) const
+            {
+                size_t h = std::hash<std::string>{}(k.text);
+                h ^= (k.beam_size * 2 + k.bidirection) * 0x9E3779B97F4A7C15ull;
+                h ^= std::hash<float>{}(k.beam_margin) * 0xC2B2AE3D27D4EB4Full;
+                h ^= std::hash<float>{}(k.candidate_margin);
+                return h;
+            }
+        };
+
+        using Entry = std::pair<Key, std::shared_ptr<const Result>>;
+
+        // the most recently used entry comes first
+        std::list<Entry> entries;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+        size_t capacity;
+        std::atomic<size_t> hits{ 0 }, misses{ 0 };
+        mutable std::mutex mtx;
+
+    public:
+        TagCache(size_t _capacity) : capacity{ _capacity }
+        {
+        }
+
+        // returns the cached result of `key`, or null after counting a miss
+        std::shared_ptr<const Result> find(const Key& key)
+        {
+            std::lock_guard<std::mutex> lock{ mtx };
+            auto it = index.find(key);
+            if (it == index.end())
+            {
+                ++misses;
+                return {};
+            }
+            ++hits;
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->second;
+        }
+
+        void insert(const Key& key, Result result)
+        {
+            if (!capacity) return;
+            auto value = std::make_shared<const Result>(std::move(result));
+            std::lock_guard<std::mutex> lock{ mtx };
+            auto it = index.find(key);
+            if (it != index.end())
+            {
+                // another thread tagged the same sentence meanwhile
+                entries.splice(entries.begin(), entries, it->second);
+                return;
+            }
+            if (entries.size() >= capacity)
+            {
+                index.erase(entries.back().first);
+                entries.pop_back();
+            }
+            entries.emplace_front(key, std::move(value));
+            index.emplace(key, entries.begin());
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock{ mtx };
+            entries.clear();
+            index.clear();
+            hits = 0;
+            misses = 0;
+        }
+
+        size_t size() const
+        {
+            std::lock_guard<std::mutex> lock{ mtx };
+            return entries.size();
+        }
+
+        size_t get_capacity() const { return capacity; }
+        size_t get_hits() const { return hits; }
+        size_t get_misses() const { return misses; }
+    };
+}
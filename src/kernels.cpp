@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <stdexcept>
+
+#include "kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define LAMON_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace lamon
+{
+    namespace kernels
+    {
+        namespace none { const KernelTable* get_table(); }
+        namespace avx2 { const KernelTable* get_table(); }
+        namespace avx512 { const KernelTable* get_table(); }
+
+        namespace detail
+        {
+            struct CpuFeatures
+            {
+                bool avx2 = false, avx512 = false;
+            };
+
+#if defined(LAMON_X86)
+            inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+            {
+#if defined(_MSC_VER)
+                int r[4];
+                __cpuidex(r, (int)leaf, (int)subleaf);
+                for (size_t i = 0; i < 4; ++i) regs[i] = (uint32_t)r[i];
+#else
+                __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+            }
+
+            // the register states enabled by the OS (XCR0)
+            inline uint64_t xgetbv()
+            {
+#if defined(_MSC_VER)
+                return _xgetbv(0);
+#else
+                uint32_t eax, edx;
+                __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+                return ((uint64_t)edx << 32) | eax;
+#endif
+            }
+#endif
+
+            inline CpuFeatures detect_cpu()
+            {
+                CpuFeatures ret;
+#if defined(LAMON_X86)
+                uint32_t r0[4], r1[4], r7[4] = { 0, };
+                cpuid(0, 0, r0);
+                cpuid(1, 0, r1);
+                if (r0[0] >= 7) cpuid(7, 0, r7);
+
+                const bool osxsave = !!(r1[2] & (1u << 27));
+                const uint64_t xcr0 = osxsave ? xgetbv() : 0;
+                const bool ymm_enabled = (xcr0 & 0x6) == 0x6, zmm_enabled = (xcr0 & 0xE6) == 0xE6;
+
+                const bool fma = !!(r1[2] & (1u << 12)), avx = !!(r1[2] & (1u << 28)), f16c = !!(r1[2] & (1u << 29));
+                const bool avx2 = !!(r7[1] & (1u << 5)), avx512f = !!(r7[1] & (1u << 16)), avx512bw = !!(r7[1] & (1u << 30));
+
+                ret.avx2 = ymm_enabled && avx && avx2 && fma && f16c;
+                ret.avx512 = ret.avx2 && zmm_enabled && avx512f && avx512bw;
+#endif
+                return ret;
+            }
+
+            inline const KernelTable* get_table(ISA isa)
+            {
+                switch (isa)
+                {
+                case ISA::avx512: return avx512::get_table();
+                case ISA::avx2: return avx2::get_table();
+                default: return none::get_table();
+                }
+            }
+
+            inline ISA select_isa()
+            {
+                const CpuFeatures cpu = detect_cpu();
+                bool allowed[3] = { true, true, true };
+
+                const char* env = std::getenv("LAMONPY_ISA");
+                if (env && *env)
+                {
+                    std::fill(allowed, allowed + 3, false);
+                    const std::string setting = env;
+                    for (size_t b = 0, e; b <= setting.size(); b = e + 1)
+                    {
+                        e = setting.find(',', b);
+                        if (e == setting.npos) e = setting.size();
+                        std::string name = setting.substr(b, e - b);
+                        for (auto& c : name) c = (char)std::tolower((unsigned char)c);
+                        if (name == "avx512") allowed[(size_t)ISA::avx512] = true;
+                        else if (name == "avx2") allowed[(size_t)ISA::avx2] = true;
+                        // `avx` and `sse2` were separate builds in older versions, now served by the baseline kernels
+                        else if (name == "none" || name == "avx" || name == "sse2") allowed[(size_t)ISA::none] = true;
+                        else if (!name.empty()) throw std::runtime_error{ "Unknown isa '" + name + "' in LAMONPY_ISA" };
+                    }
+                }
+
+                if (allowed[(size_t)ISA::avx512] && cpu.avx512 && get_table(ISA::avx512)) return ISA::avx512;
+                if (allowed[(size_t)ISA::avx2] && cpu.avx2 && get_table(ISA::avx2)) return ISA::avx2;
+                if (allowed[(size_t)ISA::none]) return ISA::none;
+                throw std::runtime_error{ std::string{ "No isa option for LAMONPY_ISA=" } + env };
+            }
+        }
+
+        const char* isa_name(ISA isa)
+        {
+            switch (isa)
+            {
+            case ISA::avx512: return "avx512";
+            case ISA::avx2: return "avx2";
+            default: return "none";
+            }
+        }
+
+        ISA active_isa()
+        {
+            static const ISA isa = detail::select_isa();
+            return isa;
+        }
+
+        const KernelTable& get_kernels()
+        {
+            static const KernelTable& table = *detail::get_table(active_isa());
+            return table;
+        }
+    }
+}
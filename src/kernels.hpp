@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+
+namespace lamon
+{
+    namespace kernels
+    {
+        // the number of columns in a panel of `gemv_panels`, which is one AVX-512 register of fp32
+        static const size_t panel_width = 16;
+
+        enum class ISA
+        {
+            none,
+            avx2,
+            avx512,
+        };
+
+        /*
+        * hot loops compiled once per instruction set (kernels_none.cpp, kernels_avx2.cpp, kernels_avx512.cpp).
+        * The table for the best instruction set supported by the CPU is selected once at runtime,
+        * so a single binary runs everywhere. See `kernels_impl.hpp` for the implementations.
+        */
+        struct KernelTable
+        {
+            void (*lstm_update)(const float* gates, float* c, float* h, size_t size, bool interleaved);
+            void (*gemv_t)(const float* a, size_t lda, size_t rows, size_t cols, const float* x, float* y, bool accumulate);
+            void (*gemv_panels)(const float* panels, size_t panel_rows, size_t row_begin, size_t rows, size_t cols, const float* x, float* y, bool accumulate);
+            void (*gemm_t)(const float* a, size_t lda, size_t rows, size_t cols, const float* x, size_t ldx, size_t n, float* y, size_t ldy, bool accumulate);
+            float (*logsumexp)(const float* src, size_t size);
+            float (*absmax)(const float* src, size_t size);
+            void (*quantize_s8)(const float* src, size_t size, float inv_scale, int8_t* dest);
+            int32_t (*dot_s8)(const int8_t* a, const int8_t* b, size_t size);
+            float (*dot_f32_s8)(const float* a, const int8_t* b, size_t size);
+            void (*fp16_to_fp32)(const uint16_t* src, size_t size, float* dest, bool accumulate);
+            void (*bf16_to_fp32)(const uint16_t* src, size_t size, float* dest, bool accumulate);
+            size_t (*ascii_alnum_prefix)(const char* str, size_t size);
+        };
+
+        const char* isa_name(ISA isa);
+
+        /*
+        * returns the instruction set in use, which is the best one supported by the CPU
+        * among those allowed by the environment variable `LAMONPY_ISA` (a comma-separated list of `avx512`, `avx2` and `none`).
+        * Throws `std::runtime_error` if none of the allowed ones is available.
+        */
+        ISA active_isa();
+
+        const KernelTable& get_kernels();
+
+        /*
+        * applies the LSTM nonlinearities and the cell update in one sweep:
+        *   c = c * sigmoid(f + 1) + sigmoid(i) * tanh(g), h = tanh(c) * sigmoid(o)
+        * `gates` holds [i, g, f, o] either as four contiguous runs of `size` values
+        * or, when `interleaved`, as consecutive blocks of [i, g, f, o] x 8 units (`size` must then be a multiple of 8).
+        */
+        inline void lstm_update(const float* gates, float* c, float* h, size_t size, bool interleaved)
+        {
+            get_kernels().lstm_update(gates, c, h, size, interleaved);
+        }
+
+        /*
+        * computes `y[j] = dot(a + j * lda, x)` over `rows` values for each of the `cols` columns of the column-major `a`,
+        * or adds it to `y[j]` if `accumulate`.
+        */
+        inline void gemv_t(const float* a, size_t lda, size_t rows, size_t cols, const float* x, float* y, bool accumulate = false)
+        {
+            get_kernels().gemv_t(a, lda, rows, cols, x, y, accumulate);
+        }
+
+        /*
+        * `gemv_t` for each of the `n` columns of the column-major `x`, storing the results in the columns of `y`:
+        * `y[c * ldy + j] = dot(a + j * lda, x + c * ldx)`. Each column of `a` is read from memory once for all columns of `x`.
+        */
+        inline void gemm_t(const float* a, size_t lda, size_t rows, size_t cols, const float* x, size_t ldx, size_t n, 
+            float* y, size_t ldy, bool accumulate = false)
+        {
+            get_kernels().gemm_t(a, lda, rows, cols, x, ldx, n, y, ldy, accumulate);
+        }
+
+        /*
+        * the same as `gemv_t` over the rows `[row_begin, row_begin + rows)` of a matrix of `panel_rows` rows
+        * repacked into panels of `panel_width` columns. Panel `p` holds the columns `[p * panel_width, (p + 1) * panel_width)`
+        * row by row, i.e. the element (i, j) is at `panels[(j / panel_width) * panel_rows * panel_width + i * panel_width + j % panel_width]`.
+        * Each row of a panel is multiplied by one broadcast `x[i]`, so no horizontal sum is needed.
+        */
+        inline void gemv_panels(const float* panels, size_t panel_rows, size_t row_begin, size_t rows, size_t cols, 
+            const float* x, float* y, bool accumulate = false)
+        {
+            get_kernels().gemv_panels(panels, panel_rows, row_begin, rows, cols, x, y, accumulate);
+        }
+
+        // returns `log(sum(exp(src[i])))`, computed from the maximum so that it cannot overflow
+        inline float logsumexp(const float* src, size_t size)
+        {
+            return get_kernels().logsumexp(src, size);
+        }
+
+        inline float absmax(const float* src, size_t size)
+        {
+            return get_kernels().absmax(src, size);
+        }
+
+        /*
+        * quantizes `src` into symmetric int8 values in [-127, 127], i.e. `dest[i] = round(src[i] * inv_scale)`.
+        * -128 is never produced, so the sign trick in `dot_s8` cannot overflow.
+        */
+        inline void quantize_s8(const float* src, size_t size, float inv_scale, int8_t* dest)
+        {
+            get_kernels().quantize_s8(src, size, inv_scale, dest);
+        }
+
+        inline int32_t dot_s8(const int8_t* a, const int8_t* b, size_t size)
+        {
+            return get_kernels().dot_s8(a, b, size);
+        }
+
+        inline float dot_f32_s8(const float* a, const int8_t* b, size_t size)
+        {
+            return get_kernels().dot_f32_s8(a, b, size);
+        }
+
+        // returns the length of the leading run of ASCII letters and digits in `str`
+        inline size_t ascii_alnum_prefix(const char* str, size_t size)
+        {
+            return get_kernels().ascii_alnum_prefix(str, size);
+        }
+
+        inline float fp16_to_fp32(uint16_t h)
+        {
+            uint32_t sign = (uint32_t)(h & 0x8000) << 16, exp = (h >> 10) & 0x1F, mant = h & 0x3FF, bits;
+            if (exp == 0x1F) bits = sign | 0x7F800000 | (mant << 13);
+            else if (exp) bits = sign | ((exp + 112) << 23) | (mant << 13);
+            else if (mant)
+            {
+                // subnormal half becomes a normal float
+                exp = 113;
+                while (!(mant & 0x400))
+                {
+                    mant <<= 1;
+                    --exp;
+                }
+                bits = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+            }
+            else bits = sign;
+            float ret;
+            std::memcpy(&ret, &bits, sizeof(float));
+            return ret;
+        }
+
+        inline uint16_t fp32_to_fp16(float f)
+        {
+            uint32_t x;
+            std::memcpy(&x, &f, sizeof(float));
+            const uint32_t sign = (x >> 16) & 0x8000, ax = x & 0x7FFFFFFF;
+            if (ax >= 0x7F800000) return sign | 0x7C00 | (ax > 0x7F800000 ? 0x200 : 0);
+            if (ax >= 0x477FF000) return sign | 0x7C00;
+            if (ax < 0x38800000) return sign | (uint32_t)std::nearbyint(std::abs(f) * 16777216.f);
+            return sign | ((ax + 0xFFF + ((ax >> 13) & 1) - 0x38000000) >> 13);
+        }
+
+        inline float bf16_to_fp32(uint16_t h)
+        {
+            uint32_t bits = (uint32_t)h << 16;
+            float ret;
+            std::memcpy(&ret, &bits, sizeof(float));
+            return ret;
+        }
+
+        inline uint16_t fp32_to_bf16(float f)
+        {
+            uint32_t x;
+            std::memcpy(&x, &f, sizeof(float));
+            if ((x & 0x7FFFFFFF) > 0x7F800000) return (x >> 16) | 0x40;
+            return (x + 0x7FFF + ((x >> 16) & 1)) >> 16;
+        }
+
+        /*
+        * expands `size` fp16 values into fp32, overwriting `dest` or, with `accumulate`, adding to it.
+        */
+        inline void fp16_to_fp32(const uint16_t* src, size_t size, float* dest, bool accumulate = false)
+        {
+            get_kernels().fp16_to_fp32(src, size, dest, accumulate);
+        }
+
+        inline void bf16_to_fp32(const uint16_t* src, size_t size, float* dest, bool accumulate = false)
+        {
+            get_kernels().bf16_to_fp32(src, size, dest, accumulate);
+        }
+    }
+}
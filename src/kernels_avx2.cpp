@@ -0,0 +1,22 @@
+// kernels for AVX2 + FMA + F16C, built with `-mavx2 -mfma -mf16c` (`/arch:AVX2` on MSVC)
+#define LAMON_KERNEL_NS avx2
+#if defined(__AVX2__)
+#include "kernels_impl.hpp"
+#else
+#include "kernels.hpp"
+
+// built without AVX2 support (e.g. for a non-x86 target): this tier is never selected
+namespace lamon
+{
+    namespace kernels
+    {
+        namespace avx2
+        {
+            const KernelTable* get_table()
+            {
+                return nullptr;
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,22 @@
+// kernels for AVX-512 F + BW, built with `-mavx512f -mavx512bw -mavx2 -mfma -mf16c` (`/arch:AVX512` on MSVC)
+#define LAMON_KERNEL_NS avx512
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+#include "kernels_impl.hpp"
+#else
+#include "kernels.hpp"
+
+// built without AVX-512 support (e.g. for a non-x86 target): this tier is never selected
+namespace lamon
+{
+    namespace kernels
+    {
+        namespace avx512
+        {
+            const KernelTable* get_table()
+            {
+                return nullptr;
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,776 @@
+/*
+* Implementations of `KernelTable`, compiled once per instruction set.
+* This file is included only by kernels_none.cpp, kernels_avx2.cpp and kernels_avx512.cpp,
+* each of which defines `LAMON_KERNEL_NS` to a distinct namespace and is compiled with its own flags.
+* Every function here lives in that namespace and calls only C library functions, never inline functions
+* shared with other translation units: the linker could otherwise pick a copy compiled for a wider instruction set.
+*/
+#ifndef LAMON_KERNEL_NS
+#error "LAMON_KERNEL_NS must be defined before including kernels_impl.hpp"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "kernels.hpp"
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define LAMON_SSE2
+#endif
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+#define LAMON_AVX512
+#endif
+
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define LAMON_F16C
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace lamon
+{
+    namespace kernels
+    {
+        namespace LAMON_KERNEL_NS
+        {
+            inline float sigmoid_scalar(float x)
+            {
+                return 1 / (1 + expf(-x));
+            }
+
+            inline size_t trailing_zeros(uint64_t v)
+            {
+#if defined(_MSC_VER)
+                unsigned long idx;
+                if (_BitScanForward(&idx, (unsigned long)v)) return idx;
+                _BitScanForward(&idx, (unsigned long)(v >> 32));
+                return idx + 32;
+#else
+                return __builtin_ctzll(v);
+#endif
+            }
+
+            inline bool is_ascii_alnum(char c)
+            {
+                return ('0' <= c && c <= '9') || ('a' <= (c | 0x20) && (c | 0x20) <= 'z');
+            }
+
+            inline float fp16_to_fp32_scalar(uint16_t h)
+            {
+                uint32_t sign = (uint32_t)(h & 0x8000) << 16, exp = (h >> 10) & 0x1F, mant = h & 0x3FF, bits;
+                if (exp == 0x1F) bits = sign | 0x7F800000 | (mant << 13);
+                else if (exp) bits = sign | ((exp + 112) << 23) | (mant << 13);
+                else if (mant)
+                {
+                    exp = 113;
+                    while (!(mant & 0x400))
+                    {
+                        mant <<= 1;
+                        --exp;
+                    }
+                    bits = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+                }
+                else bits = sign;
+                float ret;
+                memcpy(&ret, &bits, sizeof(float));
+                return ret;
+            }
+
+            inline float bf16_to_fp32_scalar(uint16_t h)
+            {
+                uint32_t bits = (uint32_t)h << 16;
+                float ret;
+                memcpy(&ret, &bits, sizeof(float));
+                return ret;
+            }
+
+#if defined(__AVX2__)
+            inline float hsum(__m256 v)
+            {
+                __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+                s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+                s = _mm_add_ss(s, _mm_movehdup_ps(s));
+                return _mm_cvtss_f32(s);
+            }
+
+            inline int32_t hsum(__m256i v)
+            {
+                __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+                s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+                s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+                return _mm_cvtsi128_si32(s);
+            }
+
+            inline __m256 fmadd(__m256 a, __m256 b, __m256 c)
+            {
+#if defined(__FMA__) || defined(_MSC_VER)
+                return _mm256_fmadd_ps(a, b, c);
+#else
+                return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+            }
+
+            // Cephes-style exp, accurate to about 1 ulp in [-88.37, 88.37]
+            inline __m256 exp(__m256 x)
+            {
+                x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f)), _mm256_set1_ps(88.3762626647949f));
+                __m256 fx = _mm256_floor_ps(fmadd(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f)));
+                x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(0.693359375f)));
+                x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+                __m256 y = _mm256_set1_ps(1.9875691500E-4f);
+                y = fmadd(y, x, _mm256_set1_ps(1.3981999507E-3f));
+                y = fmadd(y, x, _mm256_set1_ps(8.3334519073E-3f));
+                y = fmadd(y, x, _mm256_set1_ps(4.1665795894E-2f));
+                y = fmadd(y, x, _mm256_set1_ps(1.6666665459E-1f));
+                y = fmadd(y, x, _mm256_set1_ps(5.0000001201E-1f));
+                y = fmadd(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.f)));
+                __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+                return _mm256_mul_ps(y, _mm256_castsi256_ps(e));
+            }
+
+#if defined(LAMON_AVX512)
+            inline __m512 exp(__m512 x)
+            {
+                x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-88.3762626647949f)), _mm512_set1_ps(88.3762626647949f));
+                __m512 fx = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(1.44269504088896341f), _mm512_set1_ps(0.5f)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+                x = _mm512_sub_ps(x, _mm512_mul_ps(fx, _mm512_set1_ps(0.693359375f)));
+                x = _mm512_sub_ps(x, _mm512_mul_ps(fx, _mm512_set1_ps(-2.12194440e-4f)));
+                __m512 y = _mm512_set1_ps(1.9875691500E-4f);
+                y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.3981999507E-3f));
+                y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(8.3334519073E-3f));
+                y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(4.1665795894E-2f));
+                y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(1.6666665459E-1f));
+                y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(5.0000001201E-1f));
+                y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x), _mm512_add_ps(x, _mm512_set1_ps(1.f)));
+                __m512i e = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(fx), _mm512_set1_epi32(127)), 23);
+                return _mm512_mul_ps(y, _mm512_castsi512_ps(e));
+            }
+#endif
+
+            inline __m256 sigmoid(__m256 x)
+            {
+                const __m256 one = _mm256_set1_ps(1.f);
+                return _mm256_div_ps(one, _mm256_add_ps(one, exp(_mm256_sub_ps(_mm256_setzero_ps(), x))));
+            }
+
+            inline __m256 tanh(__m256 x)
+            {
+                const __m256 two = _mm256_set1_ps(2.f);
+                return _mm256_sub_ps(_mm256_mul_ps(two, sigmoid(_mm256_mul_ps(two, x))), _mm256_set1_ps(1.f));
+            }
+#endif
+
+#if defined(LAMON_SSE2)
+            // the same as the AVX2 `exp` with SSE2 only, where floor is done by truncating and correcting the negative values
+            inline __m128 exp(__m128 x)
+            {
+                x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-88.3762626647949f)), _mm_set1_ps(88.3762626647949f));
+                __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+                const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+                fx = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, fx), _mm_set1_ps(1.f)));
+                x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(0.693359375f)));
+                x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(-2.12194440e-4f)));
+                __m128 y = _mm_set1_ps(1.9875691500E-4f);
+                y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507E-3f));
+                y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073E-3f));
+                y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894E-2f));
+                y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459E-1f));
+                y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201E-1f));
+                y = _mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)), _mm_add_ps(x, _mm_set1_ps(1.f)));
+                __m128i e = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127)), 23);
+                return _mm_mul_ps(y, _mm_castsi128_ps(e));
+            }
+#endif
+
+            inline void lstm_update(const float* gates, float* c, float* h, size_t size, bool interleaved)
+            {
+                const size_t gate_stride = interleaved ? 8 : size;
+                size_t u = 0;
+#if defined(__AVX2__)
+                const __m256 one = _mm256_set1_ps(1.f);
+                for (; u + 8 <= size; u += 8)
+                {
+                    const float* g = gates + (interleaved ? u * 4 : u);
+                    __m256 ig = sigmoid(_mm256_loadu_ps(g));
+                    __m256 ni = tanh(_mm256_loadu_ps(g + gate_stride));
+                    __m256 fg = sigmoid(_mm256_add_ps(_mm256_loadu_ps(g + gate_stride * 2), one));
+                    __m256 og = sigmoid(_mm256_loadu_ps(g + gate_stride * 3));
+                    __m256 nc = fmadd(_mm256_loadu_ps(c + u), fg, _mm256_mul_ps(ig, ni));
+                    _mm256_storeu_ps(c + u, nc);
+                    _mm256_storeu_ps(h + u, _mm256_mul_ps(tanh(nc), og));
+                }
+#endif
+                for (; u < size; ++u)
+                {
+                    const float* g = gates + (interleaved ? (u / 8) * 32 + u % 8 : u);
+                    c[u] = c[u] * sigmoid_scalar(g[gate_stride * 2] + 1) + sigmoid_scalar(g[0]) * tanhf(g[gate_stride]);
+                    h[u] = tanhf(c[u]) * sigmoid_scalar(g[gate_stride * 3]);
+                }
+            }
+
+            inline float dot(const float* a, const float* x, size_t size)
+            {
+                size_t i = 0;
+                float ret = 0;
+#if defined(LAMON_AVX512)
+                __m512 acc = _mm512_setzero_ps();
+                for (; i + 16 <= size; i += 16) acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(x + i), acc);
+                if (i < size)
+                {
+                    const __mmask16 m = (__mmask16)((1u << (size - i)) - 1);
+                    acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, x + i), acc);
+                    i = size;
+                }
+                ret = _mm512_reduce_add_ps(acc);
+#elif defined(__AVX2__)
+                __m256 acc = _mm256_setzero_ps();
+                for (; i + 8 <= size; i += 8) acc = fmadd(_mm256_loadu_ps(a + i), _mm256_loadu_ps(x + i), acc);
+                ret = hsum(acc);
+#elif defined(LAMON_SSE2)
+                __m128 acc = _mm_setzero_ps();
+                for (; i + 4 <= size; i += 4) acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(x + i)));
+                acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+                acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+                ret = _mm_cvtss_f32(acc);
+#endif
+                for (; i < size; ++i) ret += a[i] * x[i];
+                return ret;
+            }
+
+            inline void gemv_t(const float* a, size_t lda, size_t rows, size_t cols, const float* x, float* y, bool accumulate)
+            {
+                size_t j = 0;
+#if defined(LAMON_AVX512)
+                // four columns at a time share each load of `x`
+                for (; j + 4 <= cols; j += 4)
+                {
+                    const float* a0 = a + j * lda, *a1 = a0 + lda, *a2 = a1 + lda, *a3 = a2 + lda;
+                    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+                    size_t i = 0;
+                    for (; i + 16 <= rows; i += 16)
+                    {
+                        const __m512 xv = _mm512_loadu_ps(x + i);
+                        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a0 + i), xv, s0);
+                        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a1 + i), xv, s1);
+                        s2 = _mm512_fmadd_ps(_mm512_loadu_ps(a2 + i), xv, s2);
+                        s3 = _mm512_fmadd_ps(_mm512_loadu_ps(a3 + i), xv, s3);
+                    }
+                    if (i < rows)
+                    {
+                        const __mmask16 m = (__mmask16)((1u << (rows - i)) - 1);
+                        const __m512 xv = _mm512_maskz_loadu_ps(m, x + i);
+                        s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a0 + i), xv, s0);
+                        s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a1 + i), xv, s1);
+                        s2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a2 + i), xv, s2);
+                        s3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a3 + i), xv, s3);
+                    }
+                    const float r[4] = { _mm512_reduce_add_ps(s0), _mm512_reduce_add_ps(s1), _mm512_reduce_add_ps(s2), _mm512_reduce_add_ps(s3) };
+                    for (size_t k = 0; k < 4; ++k) y[j + k] = accumulate ? y[j + k] + r[k] : r[k];
+                }
+#elif defined(__AVX2__)
+                for (; j + 4 <= cols; j += 4)
+                {
+                    const float* a0 = a + j * lda, *a1 = a0 + lda, *a2 = a1 + lda, *a3 = a2 + lda;
+                    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+                    size_t i = 0;
+                    for (; i + 8 <= rows; i += 8)
+                    {
+                        const __m256 xv = _mm256_loadu_ps(x + i);
+                        s0 = fmadd(_mm256_loadu_ps(a0 + i), xv, s0);
+                        s1 = fmadd(_mm256_loadu_ps(a1 + i), xv, s1);
+                        s2 = fmadd(_mm256_loadu_ps(a2 + i), xv, s2);
+                        s3 = fmadd(_mm256_loadu_ps(a3 + i), xv, s3);
+                    }
+                    float r[4] = { hsum(s0), hsum(s1), hsum(s2), hsum(s3) };
+                    for (; i < rows; ++i)
+                    {
+                        r[0] += a0[i] * x[i];
+                        r[1] += a1[i] * x[i];
+                        r[2] += a2[i] * x[i];
+                        r[3] += a3[i] * x[i];
+                    }
+                    for (size_t k = 0; k < 4; ++k) y[j + k] = accumulate ? y[j + k] + r[k] : r[k];
+                }
+#elif defined(LAMON_SSE2)
+                for (; j + 4 <= cols; j += 4)
+                {
+                    const float* a0 = a + j * lda, *a1 = a0 + lda, *a2 = a1 + lda, *a3 = a2 + lda;
+                    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+                    size_t i = 0;
+                    for (; i + 4 <= rows; i += 4)
+                    {
+                        const __m128 xv = _mm_loadu_ps(x + i);
+                        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a0 + i), xv));
+                        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a1 + i), xv));
+                        s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(a2 + i), xv));
+                        s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(a3 + i), xv));
+                    }
+                    // transposes the four accumulators so that one add yields all four sums
+                    _MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+                    float r[4];
+                    _mm_storeu_ps(r, _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+                    for (; i < rows; ++i)
+                    {
+                        r[0] += a0[i] * x[i];
+                        r[1] += a1[i] * x[i];
+                        r[2] += a2[i] * x[i];
+                        r[3] += a3[i] * x[i];
+                    }
+                    for (size_t k = 0; k < 4; ++k) y[j + k] = accumulate ? y[j + k] + r[k] : r[k];
+                }
+#endif
+                for (; j < cols; ++j)
+                {
+                    const float r = dot(a + j * lda, x, rows);
+                    y[j] = accumulate ? y[j] + r : r;
+                }
+            }
+
+            inline void gemm_t(const float* a, size_t lda, size_t rows, size_t cols, const float* x, size_t ldx, size_t n, float* y, size_t ldy, bool accumulate)
+            {
+                for (size_t j = 0; j < cols; ++j)
+                {
+                    // the column stays in the L1 cache while it is multiplied by every column of `x`, four at a time
+                    const float* aj = a + j * lda;
+                    size_t c = 0;
+                    for (; c + 4 <= n; c += 4)
+                    {
+                        const float* x0 = x + c * ldx, *x1 = x0 + ldx, *x2 = x1 + ldx, *x3 = x2 + ldx;
+                        float r[4] = { 0, 0, 0, 0 };
+                        size_t i = 0;
+#if defined(LAMON_AVX512)
+                        __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+                        for (; i + 16 <= rows; i += 16)
+                        {
+                            const __m512 av = _mm512_loadu_ps(aj + i);
+                            s0 = _mm512_fmadd_ps(av, _mm512_loadu_ps(x0 + i), s0);
+                            s1 = _mm512_fmadd_ps(av, _mm512_loadu_ps(x1 + i), s1);
+                            s2 = _mm512_fmadd_ps(av, _mm512_loadu_ps(x2 + i), s2);
+                            s3 = _mm512_fmadd_ps(av, _mm512_loadu_ps(x3 + i), s3);
+                        }
+                        if (i < rows)
+                        {
+                            const __mmask16 m = (__mmask16)((1u << (rows - i)) - 1);
+                            const __m512 av = _mm512_maskz_loadu_ps(m, aj + i);
+                            s0 = _mm512_fmadd_ps(av, _mm512_maskz_loadu_ps(m, x0 + i), s0);
+                            s1 = _mm512_fmadd_ps(av, _mm512_maskz_loadu_ps(m, x1 + i), s1);
+                            s2 = _mm512_fmadd_ps(av, _mm512_maskz_loadu_ps(m, x2 + i), s2);
+                            s3 = _mm512_fmadd_ps(av, _mm512_maskz_loadu_ps(m, x3 + i), s3);
+                            i = rows;
+                        }
+                        r[0] = _mm512_reduce_add_ps(s0);
+                        r[1] = _mm512_reduce_add_ps(s1);
+                        r[2] = _mm512_reduce_add_ps(s2);
+                        r[3] = _mm512_reduce_add_ps(s3);
+#elif defined(__AVX2__)
+                        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+                        for (; i + 8 <= rows; i += 8)
+                        {
+                            const __m256 av = _mm256_loadu_ps(aj + i);
+                            s0 = fmadd(av, _mm256_loadu_ps(x0 + i), s0);
+                            s1 = fmadd(av, _mm256_loadu_ps(x1 + i), s1);
+                            s2 = fmadd(av, _mm256_loadu_ps(x2 + i), s2);
+                            s3 = fmadd(av, _mm256_loadu_ps(x3 + i), s3);
+                        }
+                        r[0] = hsum(s0);
+                        r[1] = hsum(s1);
+                        r[2] = hsum(s2);
+                        r[3] = hsum(s3);
+#elif defined(LAMON_SSE2)
+                        __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+                        for (; i + 4 <= rows; i += 4)
+                        {
+                            const __m128 av = _mm_loadu_ps(aj + i);
+                            s0 = _mm_add_ps(s0, _mm_mul_ps(av, _mm_loadu_ps(x0 + i)));
+                            s1 = _mm_add_ps(s1, _mm_mul_ps(av, _mm_loadu_ps(x1 + i)));
+                            s2 = _mm_add_ps(s2, _mm_mul_ps(av, _mm_loadu_ps(x2 + i)));
+                            s3 = _mm_add_ps(s3, _mm_mul_ps(av, _mm_loadu_ps(x3 + i)));
+                        }
+                        _MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+                        _mm_storeu_ps(r, _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+#endif
+                        for (; i < rows; ++i)
+                        {
+                            r[0] += aj[i] * x0[i];
+                            r[1] += aj[i] * x1[i];
+                            r[2] += aj[i] * x2[i];
+                            r[3] += aj[i] * x3[i];
+                        }
+                        for (size_t k = 0; k < 4; ++k)
+                        {
+                            float& dest = y[(c + k) * ldy + j];
+                            dest = accumulate ? dest + r[k] : r[k];
+                        }
+                    }
+                    for (; c < n; ++c)
+                    {
+                        const float r = dot(aj, x + c * ldx, rows);
+                        float& dest = y[c * ldy + j];
+                        dest = accumulate ? dest + r : r;
+                    }
+                }
+            }
+
+            inline void gemv_panels(const float* panels, size_t panel_rows, size_t row_begin, size_t rows, size_t cols, const float* x, float* y, bool accumulate)
+            {
+                for (size_t j = 0; j < cols; j += panel_width)
+                {
+                    const float* p = panels + j * panel_rows + row_begin * panel_width;
+                    float r[panel_width];
+                    size_t i = 0;
+#if defined(LAMON_AVX512)
+                    // a panel row is one register, and four rows are in flight to hide the latency of fma
+                    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps(), s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+                    for (; i + 4 <= rows; i += 4)
+                    {
+                        s0 = _mm512_fmadd_ps(_mm512_set1_ps(x[i]), _mm512_loadu_ps(p + i * panel_width), s0);
+                        s1 = _mm512_fmadd_ps(_mm512_set1_ps(x[i + 1]), _mm512_loadu_ps(p + (i + 1) * panel_width), s1);
+                        s2 = _mm512_fmadd_ps(_mm512_set1_ps(x[i + 2]), _mm512_loadu_ps(p + (i + 2) * panel_width), s2);
+                        s3 = _mm512_fmadd_ps(_mm512_set1_ps(x[i + 3]), _mm512_loadu_ps(p + (i + 3) * panel_width), s3);
+                    }
+                    for (; i < rows; ++i)
+                    {
+                        s0 = _mm512_fmadd_ps(_mm512_set1_ps(x[i]), _mm512_loadu_ps(p + i * panel_width), s0);
+                    }
+                    _mm512_storeu_ps(r, _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+#elif defined(__AVX2__)
+                    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+                    for (; i + 2 <= rows; i += 2)
+                    {
+                        const __m256 x0 = _mm256_set1_ps(x[i]), x1 = _mm256_set1_ps(x[i + 1]);
+                        const float* p0 = p + i * panel_width, *p1 = p0 + panel_width;
+                        s0 = fmadd(x0, _mm256_loadu_ps(p0), s0);
+                        s1 = fmadd(x0, _mm256_loadu_ps(p0 + 8), s1);
+                        s2 = fmadd(x1, _mm256_loadu_ps(p1), s2);
+                        s3 = fmadd(x1, _mm256_loadu_ps(p1 + 8), s3);
+                    }
+                    for (; i < rows; ++i)
+                    {
+                        const __m256 x0 = _mm256_set1_ps(x[i]);
+                        s0 = fmadd(x0, _mm256_loadu_ps(p + i * panel_width), s0);
+                        s1 = fmadd(x0, _mm256_loadu_ps(p + i * panel_width + 8), s1);
+                    }
+                    _mm256_storeu_ps(r, _mm256_add_ps(s0, s2));
+                    _mm256_storeu_ps(r + 8, _mm256_add_ps(s1, s3));
+#elif defined(LAMON_SSE2)
+                    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps(), s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+                    for (; i < rows; ++i)
+                    {
+                        const __m128 xv = _mm_set1_ps(x[i]);
+                        const float* pi = p + i * panel_width;
+                        s0 = _mm_add_ps(s0, _mm_mul_ps(xv, _mm_loadu_ps(pi)));
+                        s1 = _mm_add_ps(s1, _mm_mul_ps(xv, _mm_loadu_ps(pi + 4)));
+                        s2 = _mm_add_ps(s2, _mm_mul_ps(xv, _mm_loadu_ps(pi + 8)));
+                        s3 = _mm_add_ps(s3, _mm_mul_ps(xv, _mm_loadu_ps(pi + 12)));
+                    }
+                    _mm_storeu_ps(r, s0);
+                    _mm_storeu_ps(r + 4, s1);
+                    _mm_storeu_ps(r + 8, s2);
+                    _mm_storeu_ps(r + 12, s3);
+#else
+                    for (size_t k = 0; k < panel_width; ++k) r[k] = 0;
+                    for (; i < rows; ++i)
+                    {
+                        for (size_t k = 0; k < panel_width; ++k) r[k] += x[i] * p[i * panel_width + k];
+                    }
+#endif
+                    const size_t n = cols - j < panel_width ? cols - j : panel_width;
+                    for (size_t k = 0; k < n; ++k) y[j + k] = accumulate ? y[j + k] + r[k] : r[k];
+                }
+            }
+
+            inline float logsumexp(const float* src, size_t size)
+            {
+                if (!size) return -INFINITY;
+                float max = src[0];
+                size_t i = 0;
+#if defined(LAMON_AVX512)
+                __m512 m = _mm512_set1_ps(max);
+                for (; i + 16 <= size; i += 16) m = _mm512_max_ps(m, _mm512_loadu_ps(src + i));
+                max = _mm512_reduce_max_ps(m);
+#elif defined(__AVX2__)
+                __m256 m = _mm256_set1_ps(max);
+                for (; i + 8 <= size; i += 8) m = _mm256_max_ps(m, _mm256_loadu_ps(src + i));
+                __m128 ms = _mm_max_ps(_mm256_castps256_ps128(m), _mm256_extractf128_ps(m, 1));
+                ms = _mm_max_ps(ms, _mm_movehl_ps(ms, ms));
+                ms = _mm_max_ss(ms, _mm_movehdup_ps(ms));
+                max = _mm_cvtss_f32(ms);
+#elif defined(LAMON_SSE2)
+                __m128 m = _mm_set1_ps(max);
+                for (; i + 4 <= size; i += 4) m = _mm_max_ps(m, _mm_loadu_ps(src + i));
+                m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+                m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+                max = _mm_cvtss_f32(m);
+#endif
+                for (; i < size; ++i) if (src[i] > max) max = src[i];
+
+                float sum = 0;
+                i = 0;
+#if defined(LAMON_AVX512)
+                const __m512 vmax = _mm512_set1_ps(max);
+                __m512 acc = _mm512_setzero_ps();
+                for (; i + 16 <= size; i += 16) acc = _mm512_add_ps(acc, exp(_mm512_sub_ps(_mm512_loadu_ps(src + i), vmax)));
+                if (i < size)
+                {
+                    const __mmask16 k = (__mmask16)((1u << (size - i)) - 1);
+                    acc = _mm512_add_ps(acc, _mm512_maskz_mov_ps(k, exp(_mm512_sub_ps(_mm512_maskz_loadu_ps(k, src + i), vmax))));
+                    i = size;
+                }
+                sum = _mm512_reduce_add_ps(acc);
+#elif defined(__AVX2__)
+                const __m256 vmax = _mm256_set1_ps(max);
+                __m256 acc = _mm256_setzero_ps();
+                for (; i + 8 <= size; i += 8) acc = _mm256_add_ps(acc, exp(_mm256_sub_ps(_mm256_loadu_ps(src + i), vmax)));
+                sum = hsum(acc);
+#elif defined(LAMON_SSE2)
+                const __m128 vmax = _mm_set1_ps(max);
+                __m128 acc = _mm_setzero_ps();
+                for (; i + 4 <= size; i += 4) acc = _mm_add_ps(acc, exp(_mm_sub_ps(_mm_loadu_ps(src + i), vmax)));
+                acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+                acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+                sum = _mm_cvtss_f32(acc);
+#endif
+                for (; i < size; ++i) sum += expf(src[i] - max);
+                return logf(sum) + max;
+            }
+
+            inline float absmax(const float* src, size_t size)
+            {
+                size_t i = 0;
+                float ret = 0;
+#if defined(__AVX2__)
+                const __m256 sign_mask = _mm256_set1_ps(-0.f);
+                __m256 m = _mm256_setzero_ps();
+                for (; i + 8 <= size; i += 8)
+                {
+                    m = _mm256_max_ps(m, _mm256_andnot_ps(sign_mask, _mm256_loadu_ps(src + i)));
+                }
+                __m128 s = _mm_max_ps(_mm256_castps256_ps128(m), _mm256_extractf128_ps(m, 1));
+                s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+                s = _mm_max_ss(s, _mm_movehdup_ps(s));
+                ret = _mm_cvtss_f32(s);
+#endif
+                for (; i < size; ++i)
+                {
+                    const float v = fabsf(src[i]);
+                    if (v > ret) ret = v;
+                }
+                return ret;
+            }
+
+            inline void quantize_s8(const float* src, size_t size, float inv_scale, int8_t* dest)
+            {
+                size_t i = 0;
+#if defined(__AVX2__)
+                const __m256 vs = _mm256_set1_ps(inv_scale);
+                const __m256i perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+                for (; i + 32 <= size; i += 32)
+                {
+                    __m256i a = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i), vs));
+                    __m256i b = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), vs));
+                    __m256i c = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 16), vs));
+                    __m256i d = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i + 24), vs));
+                    __m256i ab = _mm256_packs_epi32(a, b), cd = _mm256_packs_epi32(c, d);
+                    __m256i abcd = _mm256_permutevar8x32_epi32(_mm256_packs_epi16(ab, cd), perm);
+                    abcd = _mm256_max_epi8(abcd, _mm256_set1_epi8(-127));
+                    _mm256_storeu_si256((__m256i*)(dest + i), abcd);
+                }
+#endif
+                for (; i < size; ++i)
+                {
+                    float v = nearbyintf(src[i] * inv_scale);
+                    v = v < 127.f ? v : 127.f;
+                    dest[i] = (int8_t)(v > -127.f ? v : -127.f);
+                }
+            }
+
+            inline int32_t dot_s8(const int8_t* a, const int8_t* b, size_t size)
+            {
+                size_t i = 0;
+                int32_t ret = 0;
+#if defined(LAMON_AVX512)
+                {
+                    const __m512i ones = _mm512_set1_epi16(1);
+                    __m512i acc = _mm512_setzero_si512();
+                    for (; i + 64 <= size; i += 64)
+                    {
+                        __m512i va = _mm512_loadu_si512((const void*)(a + i));
+                        __m512i vb = _mm512_loadu_si512((const void*)(b + i));
+                        // |a| * (b * sign(a)), as in the AVX2 path below
+                        __m512i sb = _mm512_mask_sub_epi8(vb, _mm512_movepi8_mask(va), _mm512_setzero_si512(), vb);
+                        __m512i p = _mm512_maddubs_epi16(_mm512_abs_epi8(va), sb);
+                        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(p, ones));
+                    }
+                    ret += _mm512_reduce_add_epi32(acc);
+                }
+#endif
+#if defined(__AVX2__)
+                {
+                    const __m256i ones = _mm256_set1_epi16(1);
+                    __m256i acc = _mm256_setzero_si256();
+                    for (; i + 32 <= size; i += 32)
+                    {
+                        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+                        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+                        // |a| * (b * sign(a)) keeps maddubs' first operand unsigned
+                        __m256i p = _mm256_maddubs_epi16(_mm256_sign_epi8(va, va), _mm256_sign_epi8(vb, va));
+                        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(p, ones));
+                    }
+                    ret += hsum(acc);
+                }
+#endif
+                for (; i < size; ++i) ret += (int32_t)a[i] * b[i];
+                return ret;
+            }
+
+            inline float dot_f32_s8(const float* a, const int8_t* b, size_t size)
+            {
+                size_t i = 0;
+                float ret = 0;
+#if defined(LAMON_AVX512)
+                {
+                    __m512 acc = _mm512_setzero_ps();
+                    for (; i + 16 <= size; i += 16)
+                    {
+                        __m512 vb = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(b + i))));
+                        acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), vb, acc);
+                    }
+                    ret += _mm512_reduce_add_ps(acc);
+                }
+#endif
+#if defined(__AVX2__)
+                {
+                    __m256 acc = _mm256_setzero_ps();
+                    for (; i + 8 <= size; i += 8)
+                    {
+                        __m256 vb = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(b + i))));
+                        acc = fmadd(_mm256_loadu_ps(a + i), vb, acc);
+                    }
+                    ret += hsum(acc);
+                }
+#endif
+                for (; i < size; ++i) ret += a[i] * b[i];
+                return ret;
+            }
+
+            inline void fp16_to_fp32(const uint16_t* src, size_t size, float* dest, bool accumulate)
+            {
+                size_t i = 0;
+#if defined(LAMON_AVX512)
+                for (; i + 16 <= size; i += 16)
+                {
+                    __m512 v = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(src + i)));
+                    if (accumulate) v = _mm512_add_ps(v, _mm512_loadu_ps(dest + i));
+                    _mm512_storeu_ps(dest + i, v);
+                }
+#endif
+#if defined(LAMON_F16C)
+                for (; i + 8 <= size; i += 8)
+                {
+                    __m256 v = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i)));
+                    if (accumulate) v = _mm256_add_ps(v, _mm256_loadu_ps(dest + i));
+                    _mm256_storeu_ps(dest + i, v);
+                }
+#endif
+                for (; i < size; ++i)
+                {
+                    if (accumulate) dest[i] += fp16_to_fp32_scalar(src[i]);
+                    else dest[i] = fp16_to_fp32_scalar(src[i]);
+                }
+            }
+
+            inline void bf16_to_fp32(const uint16_t* src, size_t size, float* dest, bool accumulate)
+            {
+                size_t i = 0;
+#if defined(LAMON_AVX512)
+                for (; i + 16 <= size; i += 16)
+                {
+                    __m512i h = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(src + i)));
+                    __m512 v = _mm512_castsi512_ps(_mm512_slli_epi32(h, 16));
+                    if (accumulate) v = _mm512_add_ps(v, _mm512_loadu_ps(dest + i));
+                    _mm512_storeu_ps(dest + i, v);
+                }
+#endif
+#if defined(__AVX2__)
+                for (; i + 8 <= size; i += 8)
+                {
+                    __m256i h = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+                    __m256 v = _mm256_castsi256_ps(_mm256_slli_epi32(h, 16));
+                    if (accumulate) v = _mm256_add_ps(v, _mm256_loadu_ps(dest + i));
+                    _mm256_storeu_ps(dest + i, v);
+                }
+#endif
+                for (; i < size; ++i)
+                {
+                    if (accumulate) dest[i] += bf16_to_fp32_scalar(src[i]);
+                    else dest[i] = bf16_to_fp32_scalar(src[i]);
+                }
+            }
+
+            inline size_t ascii_alnum_prefix(const char* str, size_t size)
+            {
+                size_t i = 0;
+                // bytes >= 0x80 are negative as signed chars, so they fail every range test below
+#if defined(LAMON_AVX512)
+                for (; i + 64 <= size; i += 64)
+                {
+                    const __m512i v = _mm512_loadu_si512((const void*)(str + i));
+                    const __m512i lower = _mm512_or_si512(v, _mm512_set1_epi8(0x20));
+                    const __mmask64 alpha = _mm512_cmpgt_epi8_mask(lower, _mm512_set1_epi8('a' - 1)) & _mm512_cmpgt_epi8_mask(_mm512_set1_epi8('z' + 1), lower);
+                    const __mmask64 digit = _mm512_cmpgt_epi8_mask(v, _mm512_set1_epi8('0' - 1)) & _mm512_cmpgt_epi8_mask(_mm512_set1_epi8('9' + 1), v);
+                    const uint64_t rest = ~(uint64_t)(alpha | digit);
+                    if (rest) return i + trailing_zeros(rest);
+                }
+#endif
+#if defined(__AVX2__)
+                for (; i + 32 <= size; i += 32)
+                {
+                    const __m256i v = _mm256_loadu_si256((const __m256i*)(str + i));
+                    const __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+                    const __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+                    const __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+                    const uint32_t rest = ~(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(alpha, digit));
+                    if (rest) return i + trailing_zeros(rest);
+                }
+#elif defined(LAMON_SSE2)
+                for (; i + 16 <= size; i += 16)
+                {
+                    const __m128i v = _mm_loadu_si128((const __m128i*)(str + i));
+                    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+                    const __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), lower));
+                    const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v));
+                    const uint32_t rest = ~(uint32_t)_mm_movemask_epi8(_mm_or_si128(alpha, digit)) & 0xFFFF;
+                    if (rest) return i + trailing_zeros(rest);
+                }
+#endif
+                for (; i < size && is_ascii_alnum(str[i]); ++i);
+                return i;
+            }
+
+            const KernelTable* get_table()
+            {
+                static const KernelTable table = {
+                    lstm_update,
+                    gemv_t,
+                    gemv_panels,
+                    gemm_t,
+                    logsumexp,
+                    absmax,
+                    quantize_s8,
+                    dot_s8,
+                    dot_f32_s8,
+                    fp16_to_fp32,
+                    bf16_to_fp32,
+                    ascii_alnum_prefix,
+                };
+                return &table;
+            }
+        }
+    }
+}
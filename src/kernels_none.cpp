@@ -0,0 +1,3 @@
+// kernels for CPUs without AVX2, built with the default flags of the target
+#define LAMON_KERNEL_NS none
+#include "kernels_impl.hpp"
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <array>
+#include <memory>
 #include <unordered_map>
 #include <cmath>
 #include <Eigen/Dense>
 
 #include "rfobject.hpp"
 #include "mmap.hpp"
+#include "kernels.hpp"
 
 namespace lamon
 {
@@ -31,25 +33,104 @@ namespace lamon
         return x - max;
     }
 
+    enum class StorageType
+    {
+        fp32,
+        fp16,
+        bf16,
+    };
+
+    /*
+    * a table of embeddings stored column by column.
+    * The table can be stored in fp16 or bf16 (`*_f16:0`, `*_bf16:0` objects written by `convert_model`),
+    * in which case each column is expanded into fp32 when it is gathered.
+    */
     struct EmbeddingLookup
     {
         ConstMatrix<float> embs;
-        EmbeddingLookup(const utils::Object& o)
-            : embs{ o.template to_matrix<float>() }
+        const uint16_t* half_embs = nullptr;
+        StorageType storage = StorageType::fp32;
+        size_t rows = 0, cols = 0;
+
+        EmbeddingLookup()
+            : embs{ nullptr, 0, 0 }
         {
         }
 
         EmbeddingLookup(const ConstMatrix<float>& o)
-            : embs{ o }
+            : embs{ o }, rows(o.rows()), cols(o.cols())
+        {
+        }
+
+        /*
+        * `key` is the name of the table without its `:0` suffix. 
+        * For a rank-3 table, `last_index` selects one matrix of it.
+        */
+        EmbeddingLookup(const utils::ObjectCollection& objs, const std::string& key, size_t last_index = -1)
+            : embs{ nullptr, 0, 0 }
+        {
+            const utils::Object* obj;
+            if (objs.count(key + "_f16:0"))
+            {
+                obj = &objs[key + "_f16:0"];
+                storage = StorageType::fp16;
+            }
+            else if (objs.count(key + "_bf16:0"))
+            {
+                obj = &objs[key + "_bf16:0"];
+                storage = StorageType::bf16;
+            }
+            else
+            {
+                obj = &objs[key + ":0"];
+            }
+
+            if (obj->shape().size() != (last_index == (size_t)-1 ? 2 : 3)) throw exc::ShapeMismatch{ "cannot convert to matrix" };
+            rows = obj->shape()[0];
+            cols = obj->shape()[1];
+            const size_t offset = last_index == (size_t)-1 ? 0 : rows * cols * last_index;
+            if (storage == StorageType::fp32)
+            {
+                new (&embs) ConstMatrix<float>{ obj->template ptr<float>() + offset, (Eigen::Index)rows, (Eigen::Index)cols };
+            }
+            else
+            {
+                half_embs = obj->template ptr<uint16_t>() + offset;
+            }
+        }
+
+        EmbeddingLookup(const EmbeddingLookup& o)
+            : embs{ o.embs }, half_embs{ o.half_embs }, storage{ o.storage }, rows{ o.rows }, cols{ o.cols }
+        {
+        }
+
+        EmbeddingLookup& operator=(const EmbeddingLookup& o)
         {
+            new (&embs) ConstMatrix<float>{ o.embs };
+            half_embs = o.half_embs;
+            storage = o.storage;
+            rows = o.rows;
+            cols = o.cols;
+            return *this;
         }
 
-        size_t get_embedding_size() const { return embs.rows(); }
-        size_t get_vocab_size() const { return embs.cols(); }
+        size_t get_embedding_size() const { return rows; }
+        size_t get_vocab_size() const { return cols; }
 
-        auto operator[](size_t idx) const -> decltype(embs.col(idx))
+        template<typename _DestTy>
+        void copy_to(_DestTy&& dest, size_t idx) const
+        {
+            if (storage == StorageType::fp16) return kernels::fp16_to_fp32(half_embs + rows * idx, rows, dest.data());
+            if (storage == StorageType::bf16) return kernels::bf16_to_fp32(half_embs + rows * idx, rows, dest.data());
+            dest = embs.col(idx);
+        }
+
+        template<typename _DestTy>
+        void add_to(_DestTy&& dest, size_t idx) const
         {
-            return embs.col(idx);
+            if (storage == StorageType::fp16) return kernels::fp16_to_fp32(half_embs + rows * idx, rows, dest.data(), true);
+            if (storage == StorageType::bf16) return kernels::bf16_to_fp32(half_embs + rows * idx, rows, dest.data(), true);
+            dest += embs.col(idx);
         }
     };
 
@@ -91,62 +172,349 @@ namespace lamon
         }
     };
 
+    /*
+    * int8 kernel with one scale per output channel (column), produced by `convert_model`.
+    * Column `j` of the original kernel is approximated by `data.col(j) * scale[j]`.
+    */
+    struct QuantizedMatrix
+    {
+        const int8_t* data = nullptr;
+        const float* scale = nullptr;
+        size_t rows = 0, cols = 0;
+
+        QuantizedMatrix() = default;
+
+        QuantizedMatrix(const utils::Object& q, const utils::Object& s)
+        {
+            if (q.shape().size() != 2 || s.shape().size() != 1 || s.shape()[0] != q.shape()[1])
+            {
+                throw exc::ShapeMismatch{ "cannot convert to quantized matrix" };
+            }
+            data = q.template ptr<int8_t>();
+            scale = s.template ptr<float>();
+            rows = q.shape()[0];
+            cols = q.shape()[1];
+        }
+
+        const int8_t* col(size_t idx) const
+        {
+            return data + rows * idx;
+        }
+
+        explicit operator bool() const
+        {
+            return !!data;
+        }
+    };
+
+    /*
+    * scratch of the int8 products of `Dense`: the quantized input and the scale of each of its columns.
+    * Callers keep one per thread (see `RnnCell::Workspace`), so that the products make no heap allocation once it is sized.
+    */
+    struct QuantizeBuffer
+    {
+        std::vector<int8_t> values;
+        std::vector<float> scales;
+    };
+
+    /*
+    * A fully-connected layer. Besides its column-major `kernel`, an fp32 layer may hold a copy of 
+    * its first `panel_cols` columns repacked into panels of `kernels::panel_width` columns (see `kernels::gemv_panels`),
+    * which is used instead of `kernel` wherever it covers the requested columns.
+    * The panels are built by `pack_panels` or loaded from the `kernel_p16:0` object written by `convert_model`,
+    * along with `kernel_p16_cols:0` holding `panel_cols`. The columns padding the last panel are not counted in `panel_cols`.
+    */
     struct Dense
     {
         ConstMatrix<float> kernel;
+        QuantizedMatrix qkernel;
         ConstVector<float> bias;
+        const float* panels = nullptr;
+        size_t panel_cols = 0;
+
+    private:
+        std::shared_ptr<utils::AlignedArray<float>> owned_panels;
+
+    public:
+        Dense()
+            : kernel{ nullptr, 0, 0 }, bias{ nullptr, 0 }
+        {
+        }
 
         Dense(const utils::ObjectCollection& objs, const std::string& keys)
-            : kernel{ objs[keys + "/kernel:0"].template to_matrix<float>() },
+            : kernel{ nullptr, 0, 0 },
             bias{ objs[keys + "/bias:0"].template to_vector<float>() }
         {
+            if (objs.count(keys + "/kernel_q8:0"))
+            {
+                qkernel = QuantizedMatrix{ objs[keys + "/kernel_q8:0"], objs[keys + "/kernel_scale:0"] };
+            }
+            else
+            {
+                new (&kernel) ConstMatrix<float>{ objs[keys + "/kernel:0"].template to_matrix<float>() };
+                if (objs.count(keys + "/kernel_p16:0"))
+                {
+                    auto& obj = objs[keys + "/kernel_p16:0"];
+                    if (obj.shape().size() != 3 || obj.shape()[0] != kernels::panel_width || (Eigen::Index)obj.shape()[1] != kernel.rows()
+                        || !obj.shape()[2] || obj.shape()[2] > (output_size() + kernels::panel_width - 1) / kernels::panel_width)
+                    {
+                        throw exc::ShapeMismatch{ "wrong shape of " + keys + "/kernel_p16:0" };
+                    }
+                    panels = obj.template ptr<float>();
+                    const size_t padded_cols = std::min(obj.shape()[2] * kernels::panel_width, output_size());
+                    if (objs.count(keys + "/kernel_p16_cols:0"))
+                    {
+                        auto& cols = objs[keys + "/kernel_p16_cols:0"];
+                        if (cols.shape() != std::vector<uint32_t>{ 1 } || *cols.template ptr<uint32_t>() > padded_cols
+                            || *cols.template ptr<uint32_t>() + kernels::panel_width <= padded_cols)
+                        {
+                            throw exc::ShapeMismatch{ "wrong value of " + keys + "/kernel_p16_cols:0" };
+                        }
+                        panel_cols = *cols.template ptr<uint32_t>();
+                    }
+                    else
+                    {
+                        // the last panel may be partially filled, so only the ones before it are trusted
+                        panel_cols = (obj.shape()[2] - 1) * kernels::panel_width;
+                    }
+                }
+            }
+        }
+
+        Dense(const Dense& o)
+            : kernel{ o.kernel }, qkernel{ o.qkernel }, bias{ o.bias }, 
+            panels{ o.panels }, panel_cols{ o.panel_cols }, owned_panels{ o.owned_panels }
+        {
+        }
+
+        Dense& operator=(const Dense& o)
+        {
+            new (&kernel) ConstMatrix<float>{ o.kernel };
+            qkernel = o.qkernel;
+            new (&bias) ConstVector<float>{ o.bias };
+            panels = o.panels;
+            panel_cols = o.panel_cols;
+            owned_panels = o.owned_panels;
+            return *this;
+        }
+
+        /*
+        * repacks the first `cols` columns of an fp32 kernel into panels, padding the last panel with zeros.
+        * It does nothing for an int8 kernel, for layers narrower than one panel, or if the panels already cover `cols`.
+        */
+        void pack_panels(size_t cols = -1)
+        {
+            cols = std::min(cols, output_size());
+            if (qkernel || output_size() < kernels::panel_width || panel_cols >= cols) return;
+            const size_t rows = kernel.rows(), w = kernels::panel_width, num_panels = (cols + w - 1) / w;
+            owned_panels = std::make_shared<utils::AlignedArray<float>>(num_panels * w * rows);
+            float* dest = owned_panels->data();
+            for (size_t j = 0; j < cols; ++j)
+            {
+                const float* src = kernel.col(j).data();
+                float* p = dest + (j / w) * rows * w + j % w;
+                for (size_t i = 0; i < rows; ++i) p[i * w] = src[i];
+            }
+            panels = dest;
+            panel_cols = cols;
+        }
+
+        // writes the panels as `keys + "/kernel_p16:0"` and their column count as `keys + "/kernel_p16_cols:0"`, which the constructor loads back
+        void write_panels(utils::ObjectWriter& writer, const std::string& keys) const
+        {
+            if (!panels) return;
+            const size_t w = kernels::panel_width, num_panels = (panel_cols + w - 1) / w;
+            writer.add(keys + "/kernel_p16:0", { (uint32_t)w, (uint32_t)kernel.rows(), (uint32_t)num_panels },
+                panels, num_panels * w * kernel.rows() * sizeof(float));
+            const uint32_t cols = panel_cols;
+            writer.add(keys + "/kernel_p16_cols:0", { 1 }, &cols, sizeof(cols));
         }
 
         size_t input_size() const
         {
-            return kernel.rows();
+            return qkernel ? qkernel.rows : kernel.rows();
         }
 
         size_t output_size() const
         {
-            return kernel.cols();
+            return bias.size();
         }
 
-        template<typename _EigenTy>
-        auto operator()(_EigenTy&& x) const
-            -> decltype((kernel.transpose()* x).colwise() + bias)
+        bool is_quantized() const
+        {
+            return !!qkernel;
+        }
+
+        // returns the columns `[begin, begin + size)` of the kernel in fp32, dequantizing an int8 kernel
+        Eigen::MatrixXf columns(size_t begin, size_t size) const
+        {
+            if (!qkernel) return kernel.middleCols(begin, size);
+            Eigen::MatrixXf ret(qkernel.rows, size);
+            for (size_t i = 0; i < size; ++i)
+            {
+                const int8_t* c = qkernel.col(begin + i);
+                for (size_t r = 0; r < qkernel.rows; ++r) ret(r, i) = c[r] * qkernel.scale[begin + i];
+            }
+            return ret;
+        }
+
+        template<typename _DestTy, typename _EigenTy>
+        void apply(_DestTy&& dest, const _EigenTy& x, QuantizeBuffer& qbuf) const
         {
-            return (kernel.transpose() * x).colwise() + bias;
+            if (qkernel) return quantized_partial(dest, x, x.segment(0, 0), 0, output_size(), qbuf);
+            gemv(0, x.size(), 0, output_size(), x.data(), dest.data());
+            dest += bias;
         }
 
-        template<typename _Ty1, typename _Ty2>
-        auto apply_concated(_Ty1&& x, _Ty2&& y) const
-            -> decltype((kernel.topRows(x.rows()).transpose()* x
-                + kernel.bottomRows(y.rows()).transpose() * y).colwise() + bias)
+        // applies the layer to each column of `x`, reading the kernel once for all of them
+        template<typename _DestTy, typename _EigenTy>
+        void apply_columns(_DestTy&& dest, const _EigenTy& x, QuantizeBuffer& qbuf) const
         {
-            return (kernel.topRows(x.rows()).transpose() * x
-                + kernel.bottomRows(y.rows()).transpose() * y).colwise() + bias;
+            rows_product(dest, x, 0, qbuf);
+            dest.colwise() += bias;
         }
 
-        template<typename _EigenTy>
-        auto partial(_EigenTy&& x, size_t begin, size_t size) const
-            -> decltype((kernel.middleCols(begin, size).transpose()* x).colwise() + bias.segment(begin, size))
+        template<typename _DestTy, typename _Ty1, typename _Ty2>
+        void apply_concated(_DestTy&& dest, const _Ty1& x, const _Ty2& y, QuantizeBuffer& qbuf) const
         {
-            return (kernel.middleCols(begin, size).transpose() * x).colwise() + bias.segment(begin, size);
+            if (qkernel) return quantized_partial(dest, x, y, 0, output_size(), qbuf);
+            gemv(0, x.size(), 0, output_size(), x.data(), dest.data());
+            gemv(x.size(), y.size(), 0, output_size(), y.data(), dest.data(), true);
+            dest += bias;
+        }
+
+        template<typename _DestTy, typename _EigenTy>
+        void partial(_DestTy&& dest, const _EigenTy& x, size_t begin, size_t size, QuantizeBuffer& qbuf) const
+        {
+            if (qkernel) return quantized_partial(dest, x, x.segment(0, 0), begin, size, qbuf);
+            gemv(0, x.size(), begin, size, x.data(), dest.data());
+            dest += bias.segment(begin, size);
         }
 
         template<typename _EigenTy>
-        float partial(_EigenTy&& x, size_t idx) const
+        float partial(const _EigenTy& x, size_t idx) const
+        {
+            if (qkernel)
+            {
+                return kernels::dot_f32_s8(x.data(), qkernel.col(idx), x.size()) * qkernel.scale[idx] + bias(idx);
+            }
+            float ret;
+            kernels::gemv_t(kernel.data() + idx * kernel.rows(), kernel.rows(), x.size(), 1, x.data(), &ret);
+            return ret + bias(idx);
+        }
+
+        /*
+        * computes `dest = kernel.middleRows(row_begin, x.rows())^T * x` without bias, or adds it to `dest` if `accumulate`.
+        * This is the contribution of one part of a concatenated input. `x` may have several columns.
+        */
+        template<typename _DestTy, typename _EigenTy>
+        void rows_product(_DestTy&& dest, const _EigenTy& x, size_t row_begin, QuantizeBuffer& qbuf, bool accumulate = false) const
+        {
+            if (qkernel) return quantized_rows(dest, x, row_begin, accumulate, qbuf);
+            if (x.cols() == 1) return gemv(row_begin, x.rows(), 0, output_size(), x.data(), dest.data(), accumulate);
+            kernels::gemm_t(kernel.data() + row_begin, kernel.rows(), x.rows(), output_size(), 
+                x.data(), x.outerStride(), x.cols(), dest.data(), dest.outerStride(), accumulate);
+        }
+
+    private:
+        // computes `y = kernel.block(row_begin, col_begin, rows, cols)^T * x` from the panels if they cover the columns
+        void gemv(size_t row_begin, size_t rows, size_t col_begin, size_t cols, const float* x, float* y, bool accumulate = false) const
+        {
+            if (panels && col_begin % kernels::panel_width == 0 && col_begin + cols <= panel_cols)
+            {
+                kernels::gemv_panels(panels + col_begin * kernel.rows(), kernel.rows(), row_begin, rows, cols, x, y, accumulate);
+            }
+            else
+            {
+                kernels::gemv_t(kernel.data() + col_begin * kernel.rows() + row_begin, kernel.rows(), rows, cols, x, y, accumulate);
+            }
+        }
+
+        // quantizes each column of `x` with its own scale, and multiplies each column of the kernel by all of them in turn
+        template<typename _DestTy, typename _EigenTy>
+        void quantized_rows(_DestTy&& dest, const _EigenTy& x, size_t row_begin, bool accumulate, QuantizeBuffer& qbuf) const
+        {
+            auto& xq = qbuf.values;
+            auto& x_scales = qbuf.scales;
+            const size_t n = x.rows(), m = x.cols();
+            if (xq.size() < n * m) xq.resize(n * m);
+            if (x_scales.size() < m) x_scales.resize(m);
+
+            for (size_t c = 0; c < m; ++c)
+            {
+                const float x_absmax = kernels::absmax(x.col(c).data(), n);
+                x_scales[c] = x_absmax > 0 ? x_absmax / 127 : 1;
+                kernels::quantize_s8(x.col(c).data(), n, 1 / x_scales[c], xq.data() + c * n);
+            }
+
+            for (size_t j = 0; j < output_size(); ++j)
+            {
+                for (size_t c = 0; c < m; ++c)
+                {
+                    const float v = kernels::dot_s8(qkernel.col(j) + row_begin, xq.data() + c * n, n) * (x_scales[c] * qkernel.scale[j]);
+                    dest(j, c) = accumulate ? dest(j, c) + v : v;
+                }
+            }
+        }
+
+        /*
+        * computes `dest = kernel.middleCols(begin, size)^T * [x; y] + bias` with the int8 kernel.
+        * The input is quantized on the fly with a single symmetric scale, so the inner products run entirely on int8.
+        */
+        template<typename _DestTy, typename _Ty1, typename _Ty2>
+        void quantized_partial(_DestTy&& dest, const _Ty1& x, const _Ty2& y, size_t begin, size_t size, QuantizeBuffer& qbuf) const
         {
-            return (kernel.col(idx).transpose() * x)(0) + bias(idx);
+            auto& xq = qbuf.values;
+            const size_t n = x.size() + y.size();
+            if (xq.size() < n) xq.resize(n);
+            
+            const float x_absmax = std::max(kernels::absmax(x.data(), x.size()), kernels::absmax(y.data(), y.size()));
+            const float x_scale = x_absmax > 0 ? x_absmax / 127 : 1;
+            kernels::quantize_s8(x.data(), x.size(), 1 / x_scale, xq.data());
+            kernels::quantize_s8(y.data(), y.size(), 1 / x_scale, xq.data() + x.size());
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                const size_t j = begin + i;
+                dest(i) = kernels::dot_s8(qkernel.col(j), xq.data(), n) * (x_scale * qkernel.scale[j]) + bias(j);
+            }
         }
     };
 
+    /*
+    * LSTM cell whose gates are ordered [input, new_input, forget, output].
+    * `convert_model` stores the gate columns interleaved into blocks of `gate_block` units (see `kernels::lstm_update`),
+    * so that the update of each unit block reads its four gates from one contiguous run, and marks them with `kernel_il:0`.
+    * Cells of unmarked files are used as they are stored, so that loading never copies the kernel.
+    */
     struct LSTMCell : public Dense
     {
+        static constexpr size_t gate_block = 8;
+
+    private:
+        bool interleaved = false;
+
+    public:
+        // the column holding the original column `col` once the gates of `gate_size` units are interleaved
+        static size_t interleaved_index(size_t col, size_t gate_size)
+        {
+            const size_t gate = col / gate_size, unit = col % gate_size;
+            return (unit / gate_block) * gate_block * 4 + gate * gate_block + unit % gate_block;
+        }
+
         LSTMCell(const utils::ObjectCollection& objs, const std::string& keys)
             : Dense{ objs, keys }
         {
+            if (objs.count(keys + "/kernel_il:0"))
+            {
+                auto& block = objs[keys + "/kernel_il:0"];
+                if (block.shape() != std::vector<uint32_t>{ 1 } || *block.template ptr<uint32_t>() != gate_block
+                    || bias.size() % 4 || h_size() % gate_block)
+                {
+                    throw exc::ShapeMismatch{ "wrong value of " + keys + "/kernel_il:0" };
+                }
+                interleaved = true;
+            }
         }
 
         size_t h_size() const
@@ -156,37 +524,46 @@ namespace lamon
 
         size_t input_size() const
         {
-            return kernel.rows() - h_size();
+            return Dense::input_size() - h_size();
         }
 
-        template<typename _EigenTy1, typename _EigenTy2, typename _EigenTy3>
-        _EigenTy3& operator()(_EigenTy1&& input, _EigenTy2& c_state, _EigenTy3& h_state) const
+        bool is_interleaved() const
         {
-            Eigen::VectorXf gates = ((kernel.topRows(input.rows()).transpose() * input) + kernel.bottomRows(h_state.rows()).transpose() * h_state).colwise() + bias;
-            const size_t gate_size = h_size();
-            auto input_gate = gates.middleRows(0, gate_size).array();
-            auto new_input = gates.middleRows(gate_size, gate_size).array();
-            auto forget_gate = gates.middleRows(gate_size * 2, gate_size).array();
-            auto output_gate = gates.middleRows(gate_size * 3, gate_size).array();
+            return interleaved;
+        }
 
-            c_state = (c_state.array() * sigmoid(forget_gate + 1)) + (sigmoid(input_gate) * new_input.tanh());
-            h_state = c_state.array().tanh() * sigmoid(output_gate);
+        // runs one step on `input`, computing the gates into the caller's scratch `gates`
+        template<typename _EigenTy1, typename _EigenTy2, typename _EigenTy3>
+        _EigenTy3& operator()(_EigenTy1&& input, _EigenTy2& c_state, _EigenTy3& h_state, Eigen::VectorXf& gates, QuantizeBuffer& qbuf) const
+        {
+            gates.resize(bias.size());
+            apply_concated(gates, input, h_state, qbuf);
+            kernels::lstm_update(gates.data(), c_state.data(), h_state.data(), h_size(), interleaved);
             return h_state;
         }
 
+        /*
+        * computes the input half of the gates, `kernel.topRows(input_size())^T * input + bias`.
+        * It does not depend on the state, so it can be computed once per input and reused by `step`.
+        */
+        template<typename _DestTy, typename _EigenTy>
+        void input_gates(_DestTy&& dest, const _EigenTy& input, QuantizeBuffer& qbuf) const
+        {
+            rows_product(dest, input, 0, qbuf);
+            dest += bias;
+        }
+
+        /*
+        * runs one step from the precomputed `input_gates`, so only the recurrent half of the gates is computed here.
+        * The gates are computed into the caller's scratch `gates` (and `qbuf` for an int8 kernel), so a step makes no heap allocation once they are sized.
+        */
         template<typename _EigenTy1, typename _EigenTy2>
-        _EigenTy1& operator()(_EigenTy1& input_h, _EigenTy2& c_state) const
-        {
-            Eigen::VectorXf gates = (kernel.transpose() * input_h).colwise() + bias;
-            const size_t gate_size = h_size();
-            auto input_gate = gates.middleRows(0, gate_size).array();
-            auto new_input = gates.middleRows(gate_size, gate_size).array();
-            auto forget_gate = gates.middleRows(gate_size * 2, gate_size).array();
-            auto output_gate = gates.middleRows(gate_size * 3, gate_size).array();
-
-            c_state = (c_state.array() * sigmoid(forget_gate + 1)) + (sigmoid(input_gate) * new_input.tanh());
-            input_h.bottomRows(gate_size) = c_state.array().tanh() * sigmoid(output_gate);
-            return input_h;
+        _EigenTy2& step(const float* x_gates, _EigenTy1& c_state, _EigenTy2& h_state, Eigen::VectorXf& gates, QuantizeBuffer& qbuf) const
+        {
+            gates = Eigen::Map<const Eigen::VectorXf>{ x_gates, (Eigen::Index)bias.size() };
+            rows_product(gates, h_state, input_size(), qbuf, true);
+            kernels::lstm_update(gates.data(), c_state.data(), h_state.data(), h_size(), interleaved);
+            return h_state;
         }
     };
 }
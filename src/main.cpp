@@ -1,15 +1,108 @@
 ﻿#include <iostream>
 #include <fstream>
+#include <chrono>
 #include "Lemmatizer.h"
 #include "RnnModel.hpp"
+#include "ModelConverter.hpp"
 #include "text.hpp"
 
 using namespace std;
 
+struct TestSet
+{
+	string sent;
+	vector<tuple<string, string, lamon::Feature>> golds;
+};
+
+struct EvalResult
+{
+	size_t tot = 0, lcorrect = 0, tcorrect = 0, bcorrect = 0;
+	double elapsed = 0;
+	vector<vector<lamon::Lemmatizer::Token>> bests;
+
+	void print(const char* name) const
+	{
+		printf("[%s] L:%f (%zd) T:%f (%zd) B:%f (%zd) / total(%zd) %.1fms\n", name, lcorrect / (double)tot, lcorrect, tcorrect / (double)tot, tcorrect, bcorrect / (double)tot, bcorrect, tot, elapsed);
+	}
+
+	// prints how many tokens and sentences are tagged the same as `base`
+	void print_agreement(const char* name, const EvalResult& base) const
+	{
+		size_t tokens = 0, agreed = 0, sents_agreed = 0;
+		for (size_t i = 0; i < base.bests.size(); ++i)
+		{
+			auto& a = base.bests[i];
+			auto& b = bests[i];
+			bool all_same = a.size() == b.size();
+			for (size_t j = 0; j < a.size() && j < b.size(); ++j)
+			{
+				bool same = a[j].lemma_id == b[j].lemma_id && a[j].feature == b[j].feature;
+				agreed += same;
+				all_same = all_same && same;
+			}
+			tokens += a.size();
+			sents_agreed += all_same;
+		}
+		printf("[%s] agreement: token %f sentence %f\n", name, agreed / (double)tokens, sents_agreed / (double)base.bests.size());
+	}
+};
+
+EvalResult evaluate(const lamon::Lemmatizer& lemmatizer, const lamon::LatinRnnModel& tagging_model, const vector<TestSet>& sets)
+{
+	EvalResult res;
+	lamon::LatinRnnModel::Workspace ws;
+	auto start = chrono::high_resolution_clock::now();
+	//ofstream output{ "D:/PythonRepo2/parallel_corpus/cpp.out" };
+	for(auto& ts : sets)
+	{
+		auto ret = lemmatizer.tag(tagging_model, ts.sent, 20, true, ws)[0].second;
+		size_t gidx = 0, ptot = 0, pl = 0, pt = 0, pb = 0;
+		for (auto& r : ret)
+		{
+			//output << lemmatizer.get_lemma(r.lemma_id);
+			//if (r.feature) output << '.' << lemmatizer.to_vivens_tag(r.feature);
+			//output << ' ';
+
+			string form = ts.sent.substr(r.start, r.end - r.start);
+			if (gidx < ts.golds.size() && form == get<0>(ts.golds[gidx]))
+			{
+				++ptot;
+				bool lc = lemmatizer.get_lemma(r.lemma_id) == get<1>(ts.golds[gidx]);
+				if (r.feature == lamon::Feature::cases(7)) r.feature = {};
+				bool tc = r.feature == get<2>(ts.golds[gidx]);
+				if (lc) ++pl;
+				if (tc) ++pt;
+				if (lc && tc) ++pb;
+				++gidx;
+			}
+			else continue;
+		}
+		//output << endl;
+		res.tot += ptot;
+		res.lcorrect += pl;
+		res.tcorrect += pt;
+		res.bcorrect += pb;
+		res.bests.emplace_back(move(ret));
+	}
+	res.elapsed = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	return res;
+}
+
 int main(int argc, char** argv)
 {
 	lamon::Lemmatizer lemmatizer;
 	lamon::LatinRnnModel tagging_model{ "tagger.2.bin" };
+
+	// the int8 variant is evaluated against the fp32 model on the same test set
+	{
+		lamon::ConvertOption option;
+		option.quantize_int8 = true;
+		lamon::convert_model("tagger.2.bin", "tagger.2.q8.bin", option);
+	}
+	lamon::LatinRnnModel quantized_model{ "tagger.2.q8.bin" };
+
+	// low-rank approximations of the softmax normalizer, traded off against the exact one
+	const size_t normalizer_ranks[] = { 16, 32, 64 };
 	
 	if(1)
 	{
@@ -29,11 +122,6 @@ int main(int argc, char** argv)
 
 	ifstream testset{ "D:/PythonRepo2/parallel_corpus/data/latin_gold.tsv" };
 	string line, word;
-	struct TestSet
-	{
-		string sent;
-		vector<tuple<string, string, lamon::Feature>> golds;
-	};
 	vector<TestSet> sets;
 	while (getline(testset, line))
 	{
@@ -56,38 +144,19 @@ int main(int argc, char** argv)
 		sets.emplace_back(move(ts));
 	}
 
-	size_t tot = 0, lcorrect = 0, tcorrect = 0, bcorrect = 0;
-	//ofstream output{ "D:/PythonRepo2/parallel_corpus/cpp.out" };
-	for(auto& ts : sets)
-	{
-		auto ret = lemmatizer.tag(tagging_model, ts.sent, 20, true)[0].second;
-		size_t gidx = 0, ptot = 0, pl = 0, pt = 0, pb = 0;
-		for (auto& r : ret)
-		{
-			//output << lemmatizer.get_lemma(r.lemma_id);
-			//if (r.feature) output << '.' << lemmatizer.to_vivens_tag(r.feature);
-			//output << ' ';
+	auto fp32 = evaluate(lemmatizer, tagging_model, sets);
+	fp32.print("fp32");
+	auto int8 = evaluate(lemmatizer, quantized_model, sets);
+	int8.print("int8");
+	int8.print_agreement("int8", fp32);
 
-			string form = ts.sent.substr(r.start, r.end - r.start);
-			if (gidx < ts.golds.size() && form == get<0>(ts.golds[gidx]))
-			{
-				++ptot;
-				bool lc = lemmatizer.get_lemma(r.lemma_id) == get<1>(ts.golds[gidx]);
-				if (r.feature == lamon::Feature::cases(7)) r.feature = {};
-				bool tc = r.feature == get<2>(ts.golds[gidx]);
-				if (lc) ++pl;
-				if (tc) ++pt;
-				if (lc && tc) ++pb;
-				++gidx;
-			}
-			else continue;
-		}
-		//output << endl;
-		tot += ptot;
-		lcorrect += pl;
-		tcorrect += pt;
-		bcorrect += pb;
+	for (size_t rank : normalizer_ranks)
+	{
+		lamon::LatinRnnModel low_rank_model{ "tagger.2.bin", lamon::ModelOption{ 2048, 4096, rank } };
+		auto res = evaluate(lemmatizer, low_rank_model, sets);
+		string name = "rank " + to_string(rank);
+		res.print(name.c_str());
+		res.print_agreement(name.c_str(), fp32);
 	}
-	printf("L:%f (%zd) T:%f (%zd) B:%f (%zd) / total(%zd)\n", lcorrect / (double)tot, lcorrect, tcorrect / (double)tot, tcorrect, bcorrect / (double)tot, bcorrect, tot);
 	return 0;
 }
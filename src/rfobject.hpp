@@ -1,6 +1,12 @@
 #pragma once
 
 #include <array>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <ostream>
+#include <cstring>
 #include <unordered_map>
 #include <Eigen/Dense>
 
@@ -17,6 +23,45 @@ namespace lamon
 
     namespace utils
     {
+        /*
+        * heap array whose data is aligned to 64 bytes, so that it can back `ConstMatrix` and `ConstVector`.
+        * It holds weights rearranged at load time.
+        */
+        template<typename _Ty>
+        class AlignedArray
+        {
+            static const size_t align = 64;
+            std::vector<_Ty> buf;
+            _Ty* ptr = nullptr;
+            size_t len = 0;
+        public:
+            AlignedArray(size_t size = 0)
+            {
+                resize(size);
+            }
+
+            AlignedArray(const AlignedArray&) = delete;
+            AlignedArray& operator=(const AlignedArray&) = delete;
+
+            AlignedArray(AlignedArray&&) = default;
+            AlignedArray& operator=(AlignedArray&&) = default;
+
+            void resize(size_t size)
+            {
+                buf.assign(size + align / sizeof(_Ty), _Ty{});
+                ptr = buf.data();
+                while ((size_t)ptr % align) ++ptr;
+                len = size;
+            }
+
+            _Ty* data() { return ptr; }
+            const _Ty* data() const { return ptr; }
+            size_t size() const { return len; }
+
+            _Ty& operator[](size_t i) { return ptr[i]; }
+            const _Ty& operator[](size_t i) const { return ptr[i]; }
+        };
+
         struct RFHeader
         {
             std::array<char, 4> magic; //  ̵
@@ -28,6 +73,32 @@ namespace lamon
             // paddings...
         };
 
+        /*
+        * The v2 format starts with an index of every tensor, so that opening a file reads only its first pages.
+        *
+        * RFM2Header
+        * RFM2Entry[num_objects], each followed by `rank` uint32 shapes and `name_size` bytes of the name
+        * paddings up to `header_size`
+        * tensors, each starting at a 64-byte aligned offset
+        */
+        struct RFM2Header
+        {
+            std::array<char, 4> magic;
+            uint32_t header_size; // the size of the header and the index including paddings
+            uint32_t num_objects;
+            uint32_t reserved;
+        };
+
+        struct RFM2Entry
+        {
+            uint64_t offset; // from the beginning of the file
+            uint64_t size; // in bytes
+            uint32_t rank;
+            uint32_t name_size;
+        };
+
+        static const size_t tensor_align = 64;
+
         class ObjectCollection;
 
         class Object
@@ -35,6 +106,8 @@ namespace lamon
             friend ObjectCollection;
             const void* _base = nullptr;
             size_t _size = 0;
+            // where the data is stored in the file, which may differ from `_base` if it has been copied
+            size_t _offset = 0;
             std::vector<uint32_t> _shape;
 
             static std::pair<std::string, Object> read_one(lamon::utils::imstream& is)
@@ -62,11 +135,33 @@ namespace lamon
                 std::string name{ is.get() };
                 is.seekg(start_pos + header_size);
                 obj._base = is.get();
-                obj._size = cont_size;
+                obj._offset = start_pos + header_size;
+                obj._size = cont_size - header_size;
                 is.seekg(start_pos + cont_size);
                 return std::make_pair(name, obj);
             }
 
+            // `header_size` bounds the index, so that a corrupt `rank` or `name_size` is rejected before allocating for it
+            static std::pair<std::string, Object> read_indexed(lamon::utils::imstream& is, size_t header_size, size_t file_size)
+            {
+                RFM2Entry entry;
+                if (!is.read(&entry, sizeof(entry)) || is.tellg() > header_size) throw std::ios_base::failure{ "Wrong format" };
+                const size_t remaining = header_size - is.tellg();
+                if (entry.rank > remaining / sizeof(uint32_t)
+                    || entry.name_size > remaining - sizeof(uint32_t) * entry.rank) throw std::ios_base::failure{ "Wrong format" };
+                Object obj;
+                obj._shape.resize(entry.rank);
+                std::string name(entry.name_size, 0);
+                if (!is.read(obj._shape.data(), sizeof(uint32_t) * entry.rank)
+                    || !is.read(&name[0], entry.name_size)
+                    || entry.offset % tensor_align
+                    || entry.offset > file_size || entry.size > file_size - entry.offset) throw std::ios_base::failure{ "Wrong format" };
+                obj._base = is.base() + entry.offset;
+                obj._offset = entry.offset;
+                obj._size = entry.size;
+                return std::make_pair(name, obj);
+            }
+
             Object()
             {
             }
@@ -87,6 +182,13 @@ namespace lamon
 
             const std::vector<uint32_t>& shape() const { return _shape; }
 
+            size_t num_elements() const
+            {
+                size_t ret = 1;
+                for (auto s : _shape) ret *= s;
+                return ret;
+            }
+
             template<typename _Ty = float>
             ConstVector<_Ty> to_vector() const
             {
@@ -112,6 +214,9 @@ namespace lamon
 
         class ObjectCollection : public std::unordered_map<std::string, Object>
         {
+            // aligned copies of the tensors misaligned in v1 files
+            std::vector<AlignedArray<char>> copies;
+
         public:
             const Object& operator[](const std::string& key) const
             {
@@ -120,16 +225,179 @@ namespace lamon
                 return it->second;
             }
 
+            /*
+            * reads the objects of a v2 file from its index, or walks through every record of a v1 file.
+            * Tensors of v1 files written by other tools may not be aligned, and such ones are copied into aligned memory.
+            */
             static ObjectCollection read_from(const lamon::utils::MMap& mm)
             {
                 ObjectCollection ret;
                 lamon::utils::imstream is{ mm };
+                RFM2Header header;
+                if (is.read(&header, sizeof(header)) && header.magic == std::array<char, 4>{ 'R', 'F', 'M', '2' })
+                {
+                    if (header.header_size > mm.size() || header.header_size < sizeof(header)
+                        || header.num_objects > (header.header_size - sizeof(header)) / sizeof(RFM2Entry)) throw std::ios_base::failure{ "Wrong format" };
+                    ret.reserve(header.num_objects);
+                    for (size_t i = 0; i < header.num_objects; ++i)
+                    {
+                        ret.emplace(Object::read_indexed(is, header.header_size, mm.size()));
+                    }
+                    if (is.tellg() > header.header_size) throw std::ios_base::failure{ "Wrong format" };
+                    return ret;
+                }
+
+                is.seekg(0);
                 for (auto r = Object::read_one(is); !r.first.empty(); r = Object::read_one(is))
                 {
+                    if ((size_t)r.second.ptr<char>() % tensor_align)
+                    {
+                        ret.copies.emplace_back(r.second._size);
+                        std::memcpy(ret.copies.back().data(), r.second._base, r.second._size);
+                        r.second._base = ret.copies.back().data();
+                    }
                     ret.emplace(r);
                 }
                 return ret;
             }
+
+            /*
+            * stores an aligned copy of `data` as the object `name`, replacing the existing one, so that tensors can be rewritten before converting.
+            * A replacing object keeps the place of the replaced one in `sorted_by_offset`, and a new one goes after all the others.
+            */
+            void put_copy(const std::string& name, const std::vector<uint32_t>& shape, const void* data, size_t data_size)
+            {
+                Object obj;
+                obj._shape = shape;
+                obj._size = data_size;
+                copies.emplace_back(data_size);
+                std::memcpy(copies.back().data(), data, data_size);
+                obj._base = copies.back().data();
+                auto it = this->find(name);
+                if (it != this->end())
+                {
+                    obj._offset = it->second._offset;
+                    it->second = obj;
+                    return;
+                }
+                for (auto& p : *this) obj._offset = std::max(obj._offset, p.second._offset + 1);
+                this->emplace(name, obj);
+            }
+
+            // returns objects in the order they are stored in the file
+            std::vector<std::pair<std::string, Object>> sorted_by_offset() const
+            {
+                std::vector<std::pair<std::string, Object>> ret{ this->begin(), this->end() };
+                std::sort(ret.begin(), ret.end(), [](const std::pair<std::string, Object>& a, const std::pair<std::string, Object>& b)
+                {
+                    return a.second._offset < b.second._offset;
+                });
+                return ret;
+            }
+        };
+
+        // collects tensors and writes them into a v1 or v2 file
+        class ObjectWriter
+        {
+            struct Entry
+            {
+                std::string name;
+                std::vector<uint32_t> shape;
+                std::vector<char> data;
+            };
+            std::vector<Entry> entries;
+
+        public:
+            void add(const std::string& name, const std::vector<uint32_t>& shape, const void* data, size_t data_size)
+            {
+                entries.emplace_back();
+                entries.back().name = name;
+                entries.back().shape = shape;
+                entries.back().data.assign((const char*)data, (const char*)data + data_size);
+            }
+
+            // reorders the tensors stably by `key` of their names, for example to store them in the order they are used
+            void sort_by(const std::function<size_t(const std::string&)>& key)
+            {
+                std::stable_sort(entries.begin(), entries.end(), [&](const Entry& a, const Entry& b)
+                {
+                    return key(a.name) < key(b.name);
+                });
+            }
+
+            // writes RFMF records in the order they were added
+            void write_v1(std::ostream& os) const;
+
+            // writes the index and then the tensors in the order they were added
+            void write_v2(std::ostream& os) const;
         };
+
+        /*
+        * writes one RFMF record. The header is padded so that the content starts at a 64-byte boundary
+        * (relative to the beginning of the stream), which keeps `ConstMatrix`'s Aligned64 maps valid.
+        */
+        inline void write_object(std::ostream& os, const std::string& name, const std::vector<uint32_t>& shape, 
+            const void* data, size_t data_size)
+        {
+            static const size_t align = 64;
+            static const char zeros[align] = { 0, };
+            const size_t start_pos = os.tellp();
+            const uint32_t rank_size = shape.size();
+            const size_t raw_header_size = 4 + 4 + 8 + 4 + 4 * shape.size() + name.size() + 1;
+            const uint32_t header_size = (start_pos + raw_header_size + align - 1) / align * align - start_pos;
+            const uint64_t cont_size = (header_size + data_size + align - 1) / align * align;
+
+            os.write("RFMF", 4);
+            os.write((const char*)&header_size, sizeof(header_size));
+            os.write((const char*)&cont_size, sizeof(cont_size));
+            os.write((const char*)&rank_size, sizeof(rank_size));
+            os.write((const char*)shape.data(), sizeof(uint32_t) * shape.size());
+            os.write(name.c_str(), name.size() + 1);
+            os.write(zeros, header_size - raw_header_size);
+            os.write((const char*)data, data_size);
+            os.write(zeros, cont_size - header_size - data_size);
+        }
+
+        inline void ObjectWriter::write_v1(std::ostream& os) const
+        {
+            for (auto& e : entries) write_object(os, e.name, e.shape, e.data.data(), e.data.size());
+        }
+
+        inline void ObjectWriter::write_v2(std::ostream& os) const
+        {
+            static const char zeros[tensor_align] = { 0, };
+            auto align_up = [](size_t n) { return (n + tensor_align - 1) / tensor_align * tensor_align; };
+
+            size_t index_size = sizeof(RFM2Header);
+            for (auto& e : entries) index_size += sizeof(RFM2Entry) + sizeof(uint32_t) * e.shape.size() + e.name.size();
+
+            RFM2Header header;
+            header.magic = { 'R', 'F', 'M', '2' };
+            header.header_size = align_up(index_size);
+            header.num_objects = entries.size();
+            header.reserved = 0;
+            os.write((const char*)&header, sizeof(header));
+
+            size_t offset = header.header_size;
+            for (auto& e : entries)
+            {
+                RFM2Entry entry;
+                entry.offset = offset;
+                entry.size = e.data.size();
+                entry.rank = e.shape.size();
+                entry.name_size = e.name.size();
+                os.write((const char*)&entry, sizeof(entry));
+                os.write((const char*)e.shape.data(), sizeof(uint32_t) * e.shape.size());
+                os.write(e.name.data(), e.name.size());
+                offset += align_up(e.data.size());
+            }
+            os.write(zeros, header.header_size - index_size);
+
+            for (auto& e : entries)
+            {
+                os.write(e.data.data(), e.data.size());
+                os.write(zeros, align_up(e.data.size()) - e.data.size());
+            }
+        }
     }
 }
@@ -1,3 +1,11 @@
+import os
+
+import pytest
+
+def model_path(name):
+    import lamonpy
+    return os.path.join(os.path.dirname(lamonpy.__file__), name)
+
 def test_tag():
     from lamonpy import Lamon
     inst = Lamon()
@@ -17,3 +25,163 @@ def test_tag_multi():
     sents.append("Quemadmodum stultus est qui empturus equum non ipsum inspicit sed stratum eius ac frenos, sic stultissimus est qui hominem aut ex veste aut ex conditione, quae nobis vestis modo circumdata est, aestimandum putat.")
     for r in inst.tag_multi(sents):
         print(r)
+
+def test_convert_int8(tmp_path):
+    from lamonpy import Lamon, convert_tagger
+    dst = str(tmp_path / 'tagger.q8.bin')
+    convert_tagger(model_path('tagger.bin'), dst, quantize='int8')
+    inst = Lamon(tagger_path=dst)
+    text = "Aesopus auctor quam materiam repperit Hanc ego polivi versibus senariis"
+    res = inst.tag(text)
+    assert res
+    assert [text[start:end] for start, end, _, _ in res[0][1]] == text.split()
+
+def test_cache():
+    from lamonpy import Lamon
+    text = "Aesopus auctor quam materiam repperit Hanc ego polivi versibus senariis"
+    uncached = Lamon().tag(text)
+    inst = Lamon(cache_size=16)
+    first = inst.tag(text)
+    info = inst.cache_info()
+    assert (info['hits'], info['misses'], info['size'], info['capacity']) == (0, 1, 1, 16)
+    second = inst.tag(text)
+    info = inst.cache_info()
+    assert (info['hits'], info['misses'], info['size']) == (1, 1, 1)
+    assert first == second == uncached
+
+    inst.cache_clear()
+    info = inst.cache_info()
+    assert (info['hits'], info['misses'], info['size']) == (0, 0, 0)
+    assert inst.tag(text) == uncached
+
+def test_tag_document():
+    from lamonpy import Lamon
+    inst = Lamon()
+    sents = ["Gallia est omnis divisa in partes tres.", "Cn. Pompeius et M. Crassus consules erant!", "Quō ūsque tandem abūtēre, Catilīna, patientiā nostrā?"]
+    text = "  ".join(sents)
+    doc = inst.tag_document(text)
+    assert [text[start:end] for start, end, _ in doc] == sents
+    for start, end, results in doc:
+        alone = inst.tag(text[start:end])
+        assert len(results[0][1]) == len(alone[0][1])
+        for (s, e, lemma, tag), (s2, e2, lemma2, tag2) in zip(results[0][1], alone[0][1]):
+            assert start <= s < e <= end
+            assert (s - start, e - start, lemma, tag) == (s2, e2, lemma2, tag2)
+
+def test_convert_format_version(tmp_path):
+    from lamonpy import Lamon, convert_tagger
+    v1 = str(tmp_path / 'tagger.v1.bin')
+    v2 = str(tmp_path / 'tagger.v2.bin')
+    convert_tagger(model_path('tagger.bin'), v1, format_version=1)
+    convert_tagger(v1, v2, format_version=2)
+    text = "Aesopus auctor quam materiam repperit Hanc ego polivi versibus senariis"
+    expected = Lamon(tagger_path=v1).tag(text, beam_size=3)
+    assert Lamon(tagger_path=v2).tag(text, beam_size=3) == expected
+
+def test_session():
+    from lamonpy import Lamon
+    inst = Lamon()
+    session = inst.session(beam_size=3, search_beam_size=5)
+    text = "Gallia est omnis divisa in partes tres quarum unam incolunt Belgae"
+    assert session.tag(text) == inst.tag(text, beam_size=3, search_beam_size=5)
+    edited = text.replace("tres", "quattuor")
+    assert session.tag(edited) == inst.tag(edited, beam_size=3, search_beam_size=5)
+    assert session.resumed_from == 6
+
+def test_tag_marginals():
+    from lamonpy import Lamon
+    inst = Lamon()
+    text = "Gallia est omnis divisa in partes tres quarum unam incolunt Belgae"
+    result, marginals = inst.tag(text, marginals=True)
+    best = result[0][1]
+    assert len(marginals) == len(best)
+    for (start, end, candidates, probs), token in zip(marginals, best):
+        assert (start, end) == token[:2]
+        assert len(candidates) == len(probs)
+        assert tuple(token[2:]) in candidates
+        assert sum(probs) == pytest.approx(1, abs=1e-4)
+
+    # a greedy search keeps a single path, which takes all the mass
+    result, marginals = inst.tag(text, search_beam_size=1, marginals=True)
+    assert len(marginals) == len(result[0][1])
+    for (start, end, candidates, probs), token in zip(marginals, result[0][1]):
+        assert candidates == [tuple(token[2:])]
+        assert list(probs) == [1]
+
+    session = inst.session()
+    edited = text.replace("tres", "quattuor")
+    for t in (text, edited):
+        s_result, s_marginals = session.tag(t, marginals=True)
+        i_result, i_marginals = inst.tag(t, marginals=True)
+        assert s_result == i_result
+        assert len(s_marginals) == len(i_marginals)
+        for (start, end, candidates, probs), (i_start, i_end, i_candidates, i_probs) in zip(s_marginals, i_marginals):
+            assert (start, end, candidates) == (i_start, i_end, i_candidates)
+            assert list(probs) == pytest.approx(list(i_probs), abs=1e-4)
+
+def test_tag_multi_max_in_flight():
+    from lamonpy import Lamon
+    inst = Lamon()
+    sents = ["Aesopus auctor quam materiam repperit", "cur te, cur ultima non tenuere tuas umbras loca?", "quid timuere tui manes, precor?"]
+    num_texts, max_in_flight = 30, 4
+    pulled = [0]
+    def texts():
+        for i in range(num_texts):
+            pulled[0] += 1
+            yield sents[i % len(sents)]
+    results = []
+    for r in inst.tag_multi(texts(), num_workers=2, max_in_flight=max_in_flight):
+        results.append(r)
+        assert pulled[0] <= len(results) + max_in_flight
+    assert results == [inst.tag(sents[i % len(sents)]) for i in range(num_texts)]
+
+    for bad in (0, -1):
+        with pytest.raises(Exception):
+            inst.tag_multi(sents, max_in_flight=bad)
+
+def test_tag_multi_unordered():
+    from lamonpy import Lamon
+    inst = Lamon()
+    sents = ["Gallia est omnis divisa in partes tres, quarum unam incolunt Belgae, aliam Aquitani, tertiam qui ipsorum lingua Celtae, nostra Galli appellantur.",
+        "Arma virumque cano", "cur te, cur ultima non tenuere tuas umbras loca?", "quid timuere tui manes, precor?"] * 3
+    ordered = list(inst.tag_multi(sents, num_workers=2))
+    pairs = list(inst.tag_multi(sents, num_workers=2, ordered=False))
+    assert sorted(i for i, _ in pairs) == list(range(len(sents)))
+    for i, r in pairs:
+        assert r == ordered[i]
+
+def test_tag_arrays():
+    import numpy as np
+    from lamonpy import Lamon
+    inst = Lamon()
+    sents = ["Aesopus auctor quam materiam repperit", "", "Quō ūsque tandem abūtēre, Catilīna, patientiā nostrā?"]
+    arrays = inst.tag_arrays(sents, num_workers=2)
+    offsets = arrays['offsets']
+    num_tokens = offsets[-1]
+    for key, dtype, size in [('offsets', np.int64, len(sents) + 1), ('start', np.uint32, num_tokens), ('end', np.uint32, num_tokens),
+        ('lemma_id', np.uint32, num_tokens), ('feature', np.uint64, num_tokens), ('pos', np.uint8, num_tokens), ('score', np.float32, len(sents))]:
+        assert arrays[key].dtype == dtype
+        assert arrays[key].shape == (size,)
+    assert offsets[0] == 0
+    assert (np.diff(offsets) >= 0).all()
+
+    for i, expected in enumerate(inst.tag_multi(sents)):
+        tokens = slice(offsets[i], offsets[i + 1])
+        lemmas = inst.decode_lemmas(arrays['lemma_id'][tokens])
+        tags = inst.decode_tags(arrays['feature'][tokens], arrays['pos'][tokens])
+        got = list(zip(arrays['start'][tokens].tolist(), arrays['end'][tokens].tolist(), lemmas, tags))
+        # a text without tokens has no result
+        assert got == ([tuple(t) for t in expected[0][1]] if expected else [])
+        assert arrays['score'][i] == pytest.approx(expected[0][0] if expected else 0, abs=1e-3)
+
+def test_convert_pack_panels(tmp_path):
+    from lamonpy import Lamon, convert_tagger
+    dst = str(tmp_path / 'tagger.p16.bin')
+    # the last panel is partially filled, and `approx_size` asks for more columns than those packed
+    convert_tagger(model_path('tagger.bin'), dst, pack_panels=2050)
+    text = "Aesopus auctor quam materiam repperit Hanc ego polivi versibus senariis"
+    expected = Lamon(approx_size=2060).tag(text, beam_size=3)
+    for inst in (Lamon(tagger_path=dst, approx_size=2060), Lamon(tagger_path=dst, approx_size=2060, pack_weights=True)):
+        got = inst.tag(text, beam_size=3)
+        assert [r[1] for r in got] == [r[1] for r in expected]
+        assert [r[0] for r in got] == pytest.approx([r[0] for r in expected], abs=1e-3)